@@ -0,0 +1,73 @@
+/**
+ *
+ * Benchmark reductions over packed arrays and lists.
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/lval.c"
+
+#define ARRAY_LENGTH 8000000
+
+#ifndef ITERATIONS
+#define ITERATIONS 50
+#endif
+
+double
+seconds_since (clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+double
+scalar_sum (const double *x, long n)
+{
+  double r = 0;
+  for (long i = 0; i < n; i++) {
+    r += x[i];
+  }
+  return r;
+}
+
+int
+main ()
+{
+  larray *a = larray_create(LARRAY_F64, ARRAY_LENGTH);
+  for (long i = 0; i < ARRAY_LENGTH; i++) {
+    LARRAY_F64(a)[i] = i % 1000;
+  }
+  double mb = ITERATIONS * (ARRAY_LENGTH * sizeof(double)) / 1e6;
+
+  volatile double r = 0;
+  clock_t start = clock();
+  for (long i = 0; i < ITERATIONS; i++) {
+    r += scalar_sum(LARRAY_F64(a), a->length);
+  }
+  double t = seconds_since(start);
+  printf("scalar sum of %d floats:     %d iterations in %.3fs, %.0f MB/s\n", ARRAY_LENGTH, ITERATIONS, t, mb / t);
+
+  start = clock();
+  for (long i = 0; i < ITERATIONS; i++) {
+    r += larray_sum(LARRAY_F64(a), a->length);
+  }
+  t = seconds_since(start);
+  printf("larray_sum of %d floats:     %d iterations in %.3fs, %.0f MB/s\n", ARRAY_LENGTH, ITERATIONS, t, mb / t);
+
+  lenv *env = lenv_create(NULL);
+  lval *arg = lval_lst();
+  for (long i = 0; i < ARRAY_LENGTH; i++) {
+    lval_lst_append(arg, lval_int(i % 1000));
+  }
+  start = clock();
+  for (long i = 0; i < ITERATIONS / 10; i++) {
+    lval_free(builtin_add(env, arg));
+  }
+  printf("builtin_add of %d integers:  %d iterations in %.3fs\n", ARRAY_LENGTH, ITERATIONS / 10, seconds_since(start));
+
+  lval_free(arg);
+  lenv_free(env);
+  larray_free(a);
+  return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ *
+ * Benchmark reading a large file of expressions.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/lval.c"
+#include "../src/lreader.h"
+
+#ifndef FILE_MB
+#define FILE_MB 500
+#endif
+
+#define FILE_NAME "/tmp/bench-lread.lisp"
+
+double
+seconds_since (clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/*
+ * Write a quoted list of records, about SIZE bytes, to FILENAME.
+ */
+void
+write_data (const char *filename, long size)
+{
+  FILE *file = fopen(filename, "w");
+  long written = fprintf(file, "{\n");
+  for (long i = 0; written < size; i++) {
+    written += fprintf(file, "(record %ld \"name-%ld the quick brown fox jumps over the lazy dog"
+                       " while the five boxing wizards jump quickly\" {tag-%ld -%ld})\n",
+                       i, i, i % 1000, i % 97);
+  }
+  fprintf(file, "}\n");
+  fclose(file);
+}
+
+/*
+ * Read FILENAME through stdio into a buffer, as before mapping.
+ */
+lval *
+read_stdio (const char *filename)
+{
+  FILE *file = fopen(filename, "rb");
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *s = malloc(length);
+  length = fread(s, 1, length, file);
+  fclose(file);
+
+  lval *val = lread(filename, s, length);
+  free(s);
+  return val;
+}
+
+int
+main ()
+{
+  write_data(FILE_NAME, (long)FILE_MB << 20);
+
+  // The first pass only warms the allocator and the page cache.
+  for (int pass = 0; pass < 3; pass++) {
+    clock_t start = clock();
+    lval *val = read_stdio(FILE_NAME);
+    if (pass) {
+      printf("read of %d MB, buffered: %ld records in %.3fs\n", FILE_MB, lval_lst_length(val), seconds_since(start));
+    }
+    lval_free(val);
+
+    start = clock();
+    val = lread_file(FILE_NAME);
+    if (pass) {
+      printf("read of %d MB, mapped:   %ld records in %.3fs\n", FILE_MB, lval_lst_length(val), seconds_since(start));
+    }
+    lval_free(val);
+  }
+
+  remove(FILE_NAME);
+  return 0;
+}
@@ -0,0 +1,50 @@
+/**
+ *
+ * Benchmark looking up and evaluating large list bindings.
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/lval.c"
+
+#define LIST_LENGTH 10000
+
+#ifndef ITERATIONS
+#define ITERATIONS  10000
+#endif
+
+double
+seconds_since (clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int
+main ()
+{
+  lenv *env = lenv_create(NULL);
+  lval *lst = lval_lst();
+  for (long i = 0; i < LIST_LENGTH; i++) {
+    lval_lst_append(lst, lval_num(i));
+  }
+  lval_quote(lst);
+  lenv_put(env, "data", lst);
+  lval_free(lst);
+
+  clock_t start = clock();
+  for (long i = 0; i < ITERATIONS; i++) {
+    lval_free(lenv_get(env, "data"));
+  }
+  printf("lenv_get of %d element list:  %d iterations in %.3fs\n", LIST_LENGTH, ITERATIONS, seconds_since(start));
+
+  start = clock();
+  for (long i = 0; i < ITERATIONS; i++) {
+    lval_free(lval_eval(env, lval_sym("data")));
+  }
+  printf("lval_eval of %d element list: %d iterations in %.3fs\n", LIST_LENGTH, ITERATIONS, seconds_since(start));
+
+  lenv_free(env);
+  return 0;
+}
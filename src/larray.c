@@ -0,0 +1,187 @@
+/**
+ *
+ * Packed arrays.
+ *
+ * Arrays hold floats, 64 bit integers or bytes packed in one block of
+ * memory. Reductions over float arrays use SSE2 or, when the compiler
+ * targets it, AVX and fall back to plain loops elsewhere. The vector
+ * kernels keep four accumulators so that the loop is limited by memory
+ * bandwidth rather than by the latency of each operation. They combine
+ * the elements in a different order than a left to right loop, so sums
+ * and products may differ from it in the last bits.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "larray.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+typedef __m256d lvec;
+#define LVEC_WIDTH 4
+#define lvec_load  _mm256_loadu_pd
+#define lvec_store _mm256_storeu_pd
+#define lvec_set1  _mm256_set1_pd
+#define lvec_add   _mm256_add_pd
+#define lvec_mul   _mm256_mul_pd
+#define lvec_min   _mm256_min_pd
+#define lvec_max   _mm256_max_pd
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128d lvec;
+#define LVEC_WIDTH 2
+#define lvec_load  _mm_loadu_pd
+#define lvec_store _mm_storeu_pd
+#define lvec_set1  _mm_set1_pd
+#define lvec_add   _mm_add_pd
+#define lvec_mul   _mm_mul_pd
+#define lvec_min   _mm_min_pd
+#define lvec_max   _mm_max_pd
+#endif
+
+static const long larray_sizes[] = { sizeof(double), sizeof(int64_t), sizeof(uint8_t) };
+static const char *larray_names[] = { "f64", "i64", "u8" };
+
+long
+larray_kind_size (larray_kind kind)
+{
+  return larray_sizes[kind];
+}
+
+const char *
+larray_kind_name (larray_kind kind)
+{
+  return larray_names[kind];
+}
+
+/*
+ * Return the kind called NAME, or -1.
+ */
+int
+larray_kind_of (const char *name)
+{
+  for (int kind = LARRAY_F64; kind <= LARRAY_U8; kind++) {
+    if (strcmp(name, larray_names[kind]) == 0) {
+      return kind;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Return array of LENGTH members of KIND, the caller fills them.
+ */
+larray *
+larray_create (larray_kind kind, long length)
+{
+  larray *a = malloc(sizeof(larray) + max(length, 1) * larray_sizes[kind]);
+  a->kind = kind;
+  a->length = length;
+  a->data = a + 1;
+  return a;
+}
+
+/*
+ * Return a copy of the LENGTH members of A from START on.
+ */
+larray *
+larray_slice (const larray *a, long start, long length)
+{
+  long size = larray_sizes[a->kind];
+  larray *s = larray_create(a->kind, length);
+  memcpy(s->data, (const char*)a->data + start * size, length * size);
+  return s;
+}
+
+larray *
+larray_copy (const larray *a)
+{
+  return larray_slice(a, 0, a->length);
+}
+
+void
+larray_free (larray *a)
+{
+  free(a);
+}
+
+/*
+ * Return member I of integer array A.
+ */
+int64_t
+larray_int (const larray *a, long i)
+{
+  return (a->kind == LARRAY_I64) ? LARRAY_I64(a)[i] : LARRAY_U8(a)[i];
+}
+
+#define LARRAY_ADD(_a_,_b_) ((_a_) + (_b_))
+#define LARRAY_MUL(_a_,_b_) ((_a_) * (_b_))
+#define LARRAY_MIN(_a_,_b_) ((_b_) < (_a_) ? (_b_) : (_a_))
+#define LARRAY_MAX(_a_,_b_) ((_b_) > (_a_) ? (_b_) : (_a_))
+
+#ifdef LVEC_WIDTH
+#define LARRAY_VECTOR_LOOP(_op_,_vop_) \
+  lvec v0 = lvec_set1(r), v1 = v0, v2 = v0, v3 = v0; \
+  for (; i + 4 * LVEC_WIDTH <= n; i += 4 * LVEC_WIDTH) { \
+    v0 = _vop_(v0, lvec_load(x + i)); \
+    v1 = _vop_(v1, lvec_load(x + i + LVEC_WIDTH)); \
+    v2 = _vop_(v2, lvec_load(x + i + 2 * LVEC_WIDTH)); \
+    v3 = _vop_(v3, lvec_load(x + i + 3 * LVEC_WIDTH)); \
+  } \
+  double lanes[LVEC_WIDTH]; \
+  lvec_store(lanes, _vop_(_vop_(v0, v1), _vop_(v2, v3))); \
+  r = lanes[0]; \
+  for (int k = 1; k < LVEC_WIDTH; k++) { \
+    r = _op_(r, lanes[k]); \
+  }
+#else
+#define LARRAY_VECTOR_LOOP(_op_,_vop_)
+#endif
+
+/*
+ * Define NAME folding the N doubles at X with OP, starting from INIT.
+ * INIT must be the identity of OP or an element of X.
+ */
+#define LARRAY_KERNEL(_name_,_init_,_op_,_vop_) \
+  double \
+  _name_ (const double *x, long n) \
+  { \
+    double r = (_init_); \
+    long i = 0; \
+    LARRAY_VECTOR_LOOP(_op_, _vop_) \
+    for (; i < n; i++) { \
+      r = _op_(r, x[i]); \
+    } \
+    return r; \
+  }
+
+LARRAY_KERNEL(larray_sum, 0, LARRAY_ADD, lvec_add)
+LARRAY_KERNEL(larray_product, 1, LARRAY_MUL, lvec_mul)
+LARRAY_KERNEL(larray_min, x[0], LARRAY_MIN, lvec_min)
+LARRAY_KERNEL(larray_max, x[0], LARRAY_MAX, lvec_max)
+
+double
+larray_dot (const double *x, const double *y, long n)
+{
+  double r = 0;
+  long i = 0;
+#ifdef LVEC_WIDTH
+  lvec v0 = lvec_set1(0), v1 = v0;
+  for (; i + 2 * LVEC_WIDTH <= n; i += 2 * LVEC_WIDTH) {
+    v0 = lvec_add(v0, lvec_mul(lvec_load(x + i), lvec_load(y + i)));
+    v1 = lvec_add(v1, lvec_mul(lvec_load(x + i + LVEC_WIDTH), lvec_load(y + i + LVEC_WIDTH)));
+  }
+  double lanes[LVEC_WIDTH];
+  lvec_store(lanes, lvec_add(v0, v1));
+  for (int k = 0; k < LVEC_WIDTH; k++) {
+    r += lanes[k];
+  }
+#endif
+  for (; i < n; i++) {
+    r += x[i] * y[i];
+  }
+  return r;
+}
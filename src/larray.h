@@ -0,0 +1,37 @@
+#ifndef LARRAY_H
+#define LARRAY_H
+
+#include <stdint.h>
+
+typedef enum larray_kind { LARRAY_F64, LARRAY_I64, LARRAY_U8 } larray_kind;
+
+/*
+ * A packed array of floats, 64 bit integers or bytes. DATA follows the
+ * header in the same allocation.
+ */
+typedef struct larray {
+  larray_kind  kind;
+  long         length;
+  void        *data;
+} larray;
+
+#define LARRAY_F64(_a_) ((double*)(_a_)->data)
+#define LARRAY_I64(_a_) ((int64_t*)(_a_)->data)
+#define LARRAY_U8(_a_)  ((uint8_t*)(_a_)->data)
+
+larray * larray_create (larray_kind kind, long length);
+larray * larray_copy   (const larray *a);
+larray * larray_slice  (const larray *a, long start, long length);
+void     larray_free   (larray *a);
+long     larray_kind_size (larray_kind kind);
+const char * larray_kind_name (larray_kind kind);
+int      larray_kind_of (const char *name);
+int64_t  larray_int    (const larray *a, long i);
+
+double larray_sum     (const double *x, long n);
+double larray_product (const double *x, long n);
+double larray_min     (const double *x, long n);
+double larray_max     (const double *x, long n);
+double larray_dot     (const double *x, const double *y, long n);
+
+#endif
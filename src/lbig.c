@@ -0,0 +1,382 @@
+/**
+ *
+ * Arbitrary precision integers.
+ *
+ * Integers that do not fit in 64 bits. Limbs are 32 bits wide so that
+ * the product of two limbs plus carries fits in 64 bits. Products of
+ * large numbers of about the same size are split with Karatsuba's
+ * method, smaller ones are multiplied limb by limb.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "lbig.h"
+
+#ifndef LBIG_KARATSUBA
+#define LBIG_KARATSUBA 32
+#endif
+
+#define LBIG_DECIMAL 1000000000
+
+/*
+ * Return zero with LENGTH zero limbs, the caller fills and trims them.
+ */
+lbig *
+lbig_create (long length)
+{
+  lbig *b = calloc(1, sizeof(lbig) + max(length, 1) * sizeof(uint32_t));
+  b->length = length;
+  return b;
+}
+
+void
+lbig_free (lbig *b)
+{
+  free(b);
+}
+
+static void
+lbig_trim (lbig *b)
+{
+  while (b->length > 0 && b->limbs[b->length - 1] == 0) {
+    b->length--;
+  }
+  if (b->length == 0) {
+    b->negative = 0;
+  }
+}
+
+lbig *
+lbig_from_int (int64_t n)
+{
+  uint64_t u = (n < 0) ? -(uint64_t)n : (uint64_t)n;
+  lbig *b = lbig_create(2);
+  b->negative = n < 0;
+  b->limbs[0] = (uint32_t)u;
+  b->limbs[1] = (uint32_t)(u >> 32);
+  lbig_trim(b);
+  return b;
+}
+
+lbig *
+lbig_copy (const lbig *b)
+{
+  lbig *c = lbig_create(b->length);
+  c->negative = b->negative;
+  memcpy(c->limbs, b->limbs, b->length * sizeof(uint32_t));
+  return c;
+}
+
+/*
+ * Set *N to B and return true if B fits in 64 bits.
+ */
+int
+lbig_to_int (const lbig *b, int64_t *n)
+{
+  if (b->length > 2) {
+    return 0;
+  }
+  uint64_t u = 0;
+  for (long i = b->length - 1; i >= 0; i--) {
+    u = (u << 32) | b->limbs[i];
+  }
+  if (!b->negative) {
+    if (u > INT64_MAX) {
+      return 0;
+    }
+    *n = (int64_t)u;
+  } else {
+    if (u > (uint64_t)INT64_MAX + 1) {
+      return 0;
+    }
+    *n = (u == (uint64_t)INT64_MAX + 1) ? INT64_MIN : -(int64_t)u;
+  }
+  return 1;
+}
+
+double
+lbig_to_double (const lbig *b)
+{
+  double d = 0;
+  for (long i = b->length - 1; i >= 0; i--) {
+    d = d * 4294967296.0 + b->limbs[i];
+  }
+  return b->negative ? -d : d;
+}
+
+/*
+ * Return the integer in the LENGTH decimal digits at S, with an
+ * optional sign.
+ */
+lbig *
+lbig_parse (const char *s, long length)
+{
+  int negative = 0;
+  if (length > 0 && (*s == '+' || *s == '-')) {
+    negative = (*s == '-');
+    s++;
+    length--;
+  }
+
+  // Nine digits at a time, 10^9 < 2^32.
+  lbig *b = lbig_create(length / 9 + 1);
+  long used = 0;
+  for (long i = 0; i < length; ) {
+    uint32_t chunk = 0;
+    uint32_t scale = 1;
+    for (long n = min(9, length - i); n > 0; n--, i++) {
+      chunk = chunk * 10 + (s[i] - '0');
+      scale *= 10;
+    }
+    uint64_t carry = chunk;
+    for (long j = 0; j < used; j++) {
+      carry += (uint64_t)b->limbs[j] * scale;
+      b->limbs[j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    if (carry) {
+      b->limbs[used++] = (uint32_t)carry;
+    }
+  }
+  b->length = used;
+  b->negative = negative;
+  lbig_trim(b);
+  return b;
+}
+
+/*
+ * Return B in decimal, the caller frees the string.
+ */
+char *
+lbig_string (const lbig *b)
+{
+  long n = b->length;
+  uint32_t *mag = malloc(max(n, 1) * sizeof(uint32_t));
+  memcpy(mag, b->limbs, n * sizeof(uint32_t));
+
+  // Each limb takes less than 10 digits, so 2 chunks of 9.
+  uint32_t *chunks = malloc((2 * n + 1) * sizeof(uint32_t));
+  long count = 0;
+  while (n > 0) {
+    uint64_t rem = 0;
+    for (long i = n - 1; i >= 0; i--) {
+      uint64_t cur = (rem << 32) | mag[i];
+      mag[i] = (uint32_t)(cur / LBIG_DECIMAL);
+      rem = cur % LBIG_DECIMAL;
+    }
+    chunks[count++] = (uint32_t)rem;
+    while (n > 0 && mag[n - 1] == 0) {
+      n--;
+    }
+  }
+
+  char *s = malloc(9 * count + 3);
+  char *p = s;
+  if (b->negative) {
+    *p++ = '-';
+  }
+  if (count == 0) {
+    strcpy(p, "0");
+  } else {
+    p += sprintf(p, "%u", (unsigned)chunks[count - 1]);
+    for (long i = count - 2; i >= 0; i--) {
+      p += sprintf(p, "%09u", (unsigned)chunks[i]);
+    }
+  }
+  free(chunks);
+  free(mag);
+  return s;
+}
+
+/*
+ * Compare magnitudes A and B, both without leading zero limbs.
+ */
+static int
+mag_compare (const uint32_t *a, long na, const uint32_t *b, long nb)
+{
+  if (na != nb) {
+    return (na < nb) ? -1 : 1;
+  }
+  for (long i = na - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return (a[i] < b[i]) ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+static long
+mag_length (const uint32_t *a, long n)
+{
+  while (n > 0 && a[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+/*
+ * Add A to the NR limbs at R, which must have room for the sum.
+ */
+static void
+mag_add_to (uint32_t *r, long nr, const uint32_t *a, long na)
+{
+  uint64_t carry = 0;
+  long i;
+  for (i = 0; i < na; i++) {
+    carry += (uint64_t)r[i] + a[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  for (; carry && i < nr; i++) {
+    carry += r[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+/*
+ * Subtract A from the NR limbs at R, which must be at least A.
+ */
+static void
+mag_sub_from (uint32_t *r, long nr, const uint32_t *a, long na)
+{
+  uint64_t borrow = 0;
+  long i;
+  for (i = 0; i < na; i++) {
+    uint64_t d = (uint64_t)r[i] - a[i] - borrow;
+    r[i] = (uint32_t)d;
+    borrow = d >> 63;
+  }
+  for (; borrow && i < nr; i++) {
+    borrow = (r[i] == 0);
+    r[i]--;
+  }
+}
+
+static void
+mag_mul_school (uint32_t *r, const uint32_t *a, long na, const uint32_t *b, long nb)
+{
+  memset(r, 0, (na + nb) * sizeof(uint32_t));
+  for (long i = 0; i < na; i++) {
+    uint64_t carry = 0;
+    for (long j = 0; j < nb; j++) {
+      carry += (uint64_t)a[i] * b[j] + r[i + j];
+      r[i + j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    r[i + nb] = (uint32_t)carry;
+  }
+}
+
+/*
+ * Set the NA + NB limbs at R to A * B. With A = A1 B^m + A0 and B the
+ * same, A * B = Z2 B^2m + Z1 B^m + Z0 where Z0 = A0 B0, Z2 = A1 B1 and
+ * Z1 = (A0 + A1) (B0 + B1) - Z0 - Z2, three products of half the size.
+ */
+static void
+mag_mul (uint32_t *r, const uint32_t *a, long na, const uint32_t *b, long nb)
+{
+  if (na < nb) {
+    const uint32_t *t = a; a = b; b = t;
+    long n = na; na = nb; nb = n;
+  }
+  // B must reach into the upper half of A.
+  if (nb < LBIG_KARATSUBA || 2 * nb <= na) {
+    mag_mul_school(r, a, na, b, nb);
+    return;
+  }
+
+  long m = na / 2;
+  long na1 = na - m;
+  long nb1 = nb - m;
+  mag_mul(r, a, m, b, m);
+  mag_mul(r + 2 * m, a + m, na1, b + m, nb1);
+
+  long ns = na1 + 1;
+  long nt = max(m, nb1) + 1;
+  uint32_t *s = calloc(2 * (ns + nt), sizeof(uint32_t));
+  uint32_t *t = s + ns;
+  uint32_t *z1 = t + nt;
+  memcpy(s, a + m, na1 * sizeof(uint32_t));
+  mag_add_to(s, ns, a, m);
+  if (nb1 >= m) {
+    memcpy(t, b + m, nb1 * sizeof(uint32_t));
+    mag_add_to(t, nt, b, m);
+  } else {
+    memcpy(t, b, m * sizeof(uint32_t));
+    mag_add_to(t, nt, b + m, nb1);
+  }
+
+  mag_mul(z1, s, ns, t, nt);
+  mag_sub_from(z1, ns + nt, r, 2 * m);
+  mag_sub_from(z1, ns + nt, r + 2 * m, na1 + nb1);
+  mag_add_to(r + m, na + nb - m, z1, mag_length(z1, ns + nt));
+  free(s);
+}
+
+/*
+ * Return -1, 0 or 1 as A is less than, equal to or greater than B.
+ */
+int
+lbig_compare (const lbig *a, const lbig *b)
+{
+  if (a->negative != b->negative) {
+    return a->negative ? -1 : 1;
+  }
+  int c = mag_compare(a->limbs, a->length, b->limbs, b->length);
+  return a->negative ? -c : c;
+}
+
+/*
+ * Return A + B, or A - B if NEGATE.
+ */
+static lbig *
+lbig_add_signed (const lbig *a, const lbig *b, int negate)
+{
+  int b_negative = b->negative ^ negate;
+  lbig *r;
+  if (a->negative == b_negative) {
+    const lbig *x = (a->length >= b->length) ? a : b;
+    const lbig *y = (x == a) ? b : a;
+    r = lbig_create(x->length + 1);
+    memcpy(r->limbs, x->limbs, x->length * sizeof(uint32_t));
+    mag_add_to(r->limbs, r->length, y->limbs, y->length);
+    r->negative = a->negative;
+  } else {
+    int c = mag_compare(a->limbs, a->length, b->limbs, b->length);
+    const lbig *x = (c >= 0) ? a : b;
+    const lbig *y = (x == a) ? b : a;
+    r = lbig_create(x->length);
+    memcpy(r->limbs, x->limbs, x->length * sizeof(uint32_t));
+    mag_sub_from(r->limbs, r->length, y->limbs, y->length);
+    r->negative = (c >= 0) ? a->negative : b_negative;
+  }
+  lbig_trim(r);
+  return r;
+}
+
+lbig *
+lbig_add (const lbig *a, const lbig *b)
+{
+  return lbig_add_signed(a, b, 0);
+}
+
+lbig *
+lbig_sub (const lbig *a, const lbig *b)
+{
+  return lbig_add_signed(a, b, 1);
+}
+
+lbig *
+lbig_mul (const lbig *a, const lbig *b)
+{
+  lbig *r = lbig_create(a->length + b->length);
+  mag_mul(r->limbs, a->limbs, a->length, b->limbs, b->length);
+  r->negative = a->negative ^ b->negative;
+  lbig_trim(r);
+  return r;
+}
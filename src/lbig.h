@@ -0,0 +1,29 @@
+#ifndef LBIG_H
+#define LBIG_H
+
+#include <stdint.h>
+
+/*
+ * An integer of any size. The magnitude is stored in 32 bit limbs,
+ * least significant first, without leading zero limbs; zero has none.
+ */
+typedef struct lbig {
+  int       negative;
+  long      length;
+  uint32_t  limbs[];
+} lbig;
+
+lbig * lbig_create   (long length);
+lbig * lbig_from_int (int64_t n);
+lbig * lbig_copy     (const lbig *b);
+void   lbig_free     (lbig *b);
+lbig * lbig_parse    (const char *s, long length);
+char * lbig_string   (const lbig *b);
+int    lbig_to_int   (const lbig *b, int64_t *n);
+double lbig_to_double (const lbig *b);
+int    lbig_compare  (const lbig *a, const lbig *b);
+lbig * lbig_add      (const lbig *a, const lbig *b);
+lbig * lbig_sub      (const lbig *a, const lbig *b);
+lbig * lbig_mul      (const lbig *a, const lbig *b);
+
+#endif
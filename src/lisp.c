@@ -8,13 +8,14 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <editline/readline.h>
 #include <histedit.h>
 
 #include "util.h"
 #include "lval.h"
-#include "mpc/mpc.h"
-#include "lparser.h"
+#include "lreader.h"
 
 int
 main (int argc, char **argv)
@@ -23,35 +24,37 @@ main (int argc, char **argv)
   puts("Press ctrl+c to exit");
 
   lenv  *env = lenv_create(NULL);
-  lparser *p = lparser_create();
 
-  lenv_register_builtin(env, "identity", builtin_identity, 0);
-  lenv_register_builtin(env, "lambda", builtin_lambda, 1);
-  lenv_register_builtin(env, "equal", builtin_equal, 0);
-  lenv_register_builtin(env, "quote", builtin_quote, 1);
-  lenv_register_builtin(env, "eval", builtin_eval, 0);
-  lenv_register_builtin(env, "load", builtin_load, 0);
-  lenv_register_builtin(env, "head", builtin_head, 0);
-  lenv_register_builtin(env, "tail", builtin_tail, 0);
-  lenv_register_builtin(env, "list", builtin_list, 0);
-  lenv_register_builtin(env, "join", builtin_join, 0);
-  lenv_register_builtin(env, "def", builtin_def, 1);
-  lenv_register_builtin(env, "not", builtin_not, 0);
-  lenv_register_builtin(env, "and", builtin_and, 1);
-  lenv_register_builtin(env, "or", builtin_or, 1);
-  lenv_register_builtin(env, ">", builtin_gt, 0);
-  lenv_register_builtin(env, "<", builtin_lt, 0);
-  lenv_register_builtin(env, "=", builtin_eq, 0);
-  lenv_register_builtin(env, "if", builtin_if, 1);
-  lenv_register_builtin(env, ">=", builtin_ge, 0);
-  lenv_register_builtin(env, "<=", builtin_le, 0);
-  lenv_register_builtin(env, "+", builtin_add, 0);
-  lenv_register_builtin(env, "-", builtin_sub, 0);
-  lenv_register_builtin(env, "*", builtin_mul, 0);
-  lenv_register_builtin(env, "/", builtin_div, 0);
+  lenv_register_builtins(env);
 
   if (argc > 1) {
     for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--interpret") == 0) {
+        lcode_enabled = 0;
+        continue;
+      }
+      if (strcmp(argv[i], "--mpc") == 0) {
+        lreader_mpc = 1;
+        continue;
+      }
+      if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+        lenv *image = limage_load(argv[++i]);
+        if (image == NULL) {
+          printf("Unable to load image: %s\n", argv[i]);
+          break;
+        }
+        lenv_free(env);
+        env = image;
+        continue;
+      }
+      if (strncmp(argv[i], "--gc-threshold=", 15) == 0) {
+        lgc_threshold = atol(argv[i] + 15);
+        continue;
+      }
+      if (strncmp(argv[i], "--gc-growth=", 12) == 0) {
+        lgc_growth = atol(argv[i] + 12);
+        continue;
+      }
       lval *arg = lval_lst_append(lval_lst(), lval_str(argv[i]));
       lval *err = builtin_load(env, arg);
       lval_free(arg);
@@ -68,25 +71,19 @@ main (int argc, char **argv)
     char *input = string_trim(readline("> "));
     if (input) {
       add_history(input);
-      if (lparser_parse(p, input)) {
-
-        lval *val = lval_eval(env, read_lval(lparser_ast(p)));
+      lval *val = lread("<stdin>", input, strlen(input));
+      if (lval_type(val) != LVAL_ERR) {
+        val = lval_eval(env, val);
+      }
 
-        lval_print(val);
-        putchar('\n');
+      lval_print(val);
+      putchar('\n');
 
-        lval_free(val);
-        lparser_ast_delete(p);
-      } else {
-        char *errmsg = lparser_error(p);
-        printf("%s", errmsg);
-        free(errmsg);
-      }
+      lval_free(val);
     }
     free(input);
   }
 
   lenv_free(env);
-  lparser_delete(p);
   return 0;
 }
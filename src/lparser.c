@@ -2,8 +2,14 @@
  *
  * Parser functions.
  *
+ * The grammar is built once, on first use, and shared by all parsers;
+ * a parser only holds the result of its last parse so that several
+ * threads can parse at once.
+ *
  */
 
+#include <pthread.h>
+
 #include "mpc/mpc.h"
 #include "lval.h"
 
@@ -11,7 +17,7 @@
 
 static const char *grammar =
   "symbol: /[a-zA-Z0-9+\\-*\\/!?%<=>&]+/    ; "
-  "number: /[+-]?[0-9]+]*/                  ; "
+  "number: /[+-]?[0-9]+(\\.[0-9]+)?/         ; "
   "comment: /;[^\\r\\n]*/                   ; "
   "string: /\"(\\\\.|[^\"])*\"/             ; "
   "atom: <number> | <symbol> | <string>     ; "
@@ -24,45 +30,48 @@ static const char *lparser_names[] = {
   "lisp", "sexp", "list", "atom", "string", "comment", "number", "symbol"
 };
 
+static mpc_parser_t *lparser_grammar[NR_OF_PARSERS];
+static pthread_once_t lparser_once = PTHREAD_ONCE_INIT;
+
 typedef struct lparser {
-  mpc_parser_t *parsers[NR_OF_PARSERS];
+  mpc_parser_t **parsers;
   mpc_result_t   result;
 } lparser;
 
-lparser *
-lparser_create ()
+/*
+ * Build the shared grammar. It lives until the process exits.
+ */
+static void
+lparser_init ()
 {
-  lparser *p = malloc(sizeof(lparser));
-
   for (long i = 0; i < NR_OF_PARSERS; i++) {
-    p->parsers[i] = mpc_new(lparser_names[i]);
+    lparser_grammar[i] = mpc_new(lparser_names[i]);
   }
 
-  mpca_lang(MPCA_LANG_DEFAULT, grammar, 
-            p->parsers[0],
-            p->parsers[1],
-            p->parsers[2],
-            p->parsers[3],
-            p->parsers[4],
-            p->parsers[5],
-            p->parsers[6],
-            p->parsers[7]);
+  mpca_lang(MPCA_LANG_DEFAULT, grammar,
+            lparser_grammar[0],
+            lparser_grammar[1],
+            lparser_grammar[2],
+            lparser_grammar[3],
+            lparser_grammar[4],
+            lparser_grammar[5],
+            lparser_grammar[6],
+            lparser_grammar[7]);
+}
 
+lparser *
+lparser_create ()
+{
+  pthread_once(&lparser_once, lparser_init);
+
+  lparser *p = malloc(sizeof(lparser));
+  p->parsers = lparser_grammar;
   return p;
 }
 
 void
 lparser_delete (lparser *p)
 {
-  mpc_cleanup(NR_OF_PARSERS,
-              p->parsers[0],
-              p->parsers[1],
-              p->parsers[2],
-              p->parsers[3],
-              p->parsers[4],
-              p->parsers[5],
-              p->parsers[6],
-              p->parsers[7]);
   free(p);
 }
 
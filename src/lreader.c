@@ -0,0 +1,460 @@
+/**
+ *
+ * Reader functions.
+ *
+ * The reader turns the text of one expression directly into values in
+ * a single pass. It accepts the same language as the mpc grammar in
+ * lparser.c, which can still be used instead by setting lreader_mpc.
+ *
+ * A stream reads one expression after another from a file descriptor,
+ * keeping no more than the expression being read in memory. Regular
+ * files are mapped instead.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "lval.h"
+#include "lparser.h"
+#include "lreader.h"
+
+int lreader_mpc = 0;
+
+#ifndef LSTREAM_CHUNK
+#define LSTREAM_CHUNK 65536
+#endif
+
+typedef struct lreader {
+  const char *name;
+  const char *start;
+  const char *pos;
+  const char *end;
+  long        line;
+  long        col;
+} lreader;
+
+/*
+ * The unread input is buffer[start..end), LINE and COL are its position
+ * in the file.
+ */
+typedef struct lstream {
+  const char *name;
+  int         fd;
+  int         owned;
+  int         eof;
+  char       *buffer;
+  long        start;
+  long        end;
+  long        capacity;
+  long        mapped;
+  long        line;
+  long        col;
+} lstream;
+
+static int
+lread_is_symbol (int c)
+{
+  return isalnum(c) || (c && strchr("+-*/!?%<=>&", c));
+}
+
+/*
+ * Return a copy of the LENGTH bytes at S. Unlike string_substring() S
+ * need not be terminated.
+ */
+char *
+lread_copy (const char *s, long length)
+{
+  char *d = malloc(length + 1);
+  memcpy(d, s, length);
+  d[length] = 0;
+  return d;
+}
+
+/*
+ * Return error MSG at the current position.
+ */
+lval *
+lread_error (const lreader *r, const char *msg)
+{
+  long line = r->line;
+  long col = r->col;
+  for (const char *p = r->start; p < r->pos; p++) {
+    if (*p == '\n') {
+      line++;
+      col = 1;
+    } else {
+      col++;
+    }
+  }
+  if (r->pos == r->end) {
+    return lval_err("%s:%ld:%ld: error: %s at end of input", r->name, line, col, msg);
+  }
+  return lval_err("%s:%ld:%ld: error: %s at '%c'", r->name, line, col, msg, *r->pos);
+}
+
+/*
+ * Skip whitespace and comments.
+ */
+void
+lread_skip (lreader *r)
+{
+  while (r->pos < r->end) {
+    if (isspace((unsigned char)*r->pos)) {
+      r->pos++;
+    } else if (*r->pos == ';') {
+      while (r->pos < r->end && *r->pos != '\n') {
+        r->pos++;
+      }
+    } else {
+      break;
+    }
+  }
+}
+
+/*
+ * Read integer or, with a fraction, float.
+ */
+lval *
+lread_number (lreader *r)
+{
+  const char *start = r->pos;
+  if (*r->pos == '+' || *r->pos == '-') {
+    r->pos++;
+  }
+  while (r->pos < r->end && isdigit((unsigned char)*r->pos)) {
+    r->pos++;
+  }
+  if (r->pos + 1 < r->end && *r->pos == '.' && isdigit((unsigned char)r->pos[1])) {
+    r->pos++;
+    while (r->pos < r->end && isdigit((unsigned char)*r->pos)) {
+      r->pos++;
+    }
+  }
+  return lval_number(start, r->pos - start);
+}
+
+lval *
+lread_symbol (lreader *r)
+{
+  const char *start = r->pos;
+  while (r->pos < r->end && lread_is_symbol((unsigned char)*r->pos)) {
+    r->pos++;
+  }
+  long length = r->pos - start;
+  if (length == 3 && strncmp(start, "nil", 3) == 0) {
+    return LVAL_NIL();
+  }
+  return lval_sym_n(start, length);
+}
+
+/*
+ * Read string, the contents are kept as written, escapes included.
+ */
+lval *
+lread_string (lreader *r)
+{
+  const char *start = ++r->pos;
+  while (r->pos < r->end && *r->pos != '"') {
+    if (*r->pos == '\\' && r->pos + 1 < r->end) {
+      r->pos++;
+    }
+    r->pos++;
+  }
+  if (r->pos == r->end) {
+    return lread_error(r, "expected '\"'");
+  }
+
+  lval *val = lval_str_n(start, r->pos - start);
+  r->pos++;
+  return val;
+}
+
+lval *lread_sexp (lreader *r);
+
+lval *
+lread_list (lreader *r)
+{
+  char close = (*r->pos == '{') ? '}' : ')';
+  lval *lst = lval_lst();
+  if (close == '}') {
+    lval_quote(lst);
+  }
+  r->pos++;
+
+  while (1) {
+    lread_skip(r);
+    if (r->pos < r->end && *r->pos == close) {
+      r->pos++;
+      return lst;
+    }
+    if (r->pos == r->end) {
+      lval_free(lst);
+      return lread_error(r, close == '}' ? "expected '}'" : "expected ')'");
+    }
+    lval *val = lread_sexp(r);
+    if (lval_type(val) == LVAL_ERR) {
+      lval_free(lst);
+      return val;
+    }
+    lval_lst_append(lst, val);
+  }
+}
+
+lval *
+lread_sexp (lreader *r)
+{
+  lread_skip(r);
+  if (r->pos == r->end) {
+    return lread_error(r, "expected expression");
+  }
+
+  char c = *r->pos;
+  if (c == '(' || c == '{') {
+    return lread_list(r);
+  }
+  if (c == '"') {
+    return lread_string(r);
+  }
+  const char *digit = (c == '+' || c == '-') ? r->pos + 1 : r->pos;
+  if (digit < r->end && isdigit((unsigned char)*digit)) {
+    return lread_number(r);
+  }
+  if (lread_is_symbol((unsigned char)c)) {
+    return lread_symbol(r);
+  }
+  return lread_error(r, "expected expression");
+}
+
+lval *
+lread_mpc (lparser *p, int ok)
+{
+  lval *val;
+  if (ok) {
+    val = read_lval(lparser_ast(p));
+    lparser_ast_delete(p);
+  } else {
+    char *errmsg = lparser_error(p);
+    errmsg[strcspn(errmsg, "\n")] = 0;
+    val = lval_err("%s", errmsg);
+    free(errmsg);
+  }
+  lparser_delete(p);
+  return val;
+}
+
+/*
+ * Read the expression in the LENGTH bytes at S, NAME is used in error
+ * messages. Returns the expression or an error.
+ */
+lval *
+lread (const char *name, const char *s, long length)
+{
+  if (lreader_mpc) {
+    char *str = lread_copy(s, length);
+    lparser *p = lparser_create();
+    lval *val = lread_mpc(p, lparser_parse(p, str));
+    free(str);
+    return val;
+  }
+
+  lreader r = { name, s, s, s + length, 1, 1 };
+  lval *val = lread_sexp(&r);
+  if (lval_type(val) == LVAL_ERR) {
+    return val;
+  }
+  lread_skip(&r);
+  if (r.pos < r.end) {
+    lval_free(val);
+    return lread_error(&r, "expected end of input");
+  }
+  return val;
+}
+
+/*
+ * Return stream reading from FD, NAME is used in error messages. Both
+ * must outlive the stream.
+ */
+lstream *
+lstream_open (const char *name, int fd)
+{
+  lstream *s = calloc(1, sizeof(lstream));
+  s->name = name;
+  s->fd = fd;
+  s->line = 1;
+  s->col = 1;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    char *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      s->buffer = mapped;
+      s->end = s->mapped = st.st_size;
+      s->eof = 1;
+    }
+  }
+  return s;
+}
+
+/*
+ * Return stream reading FILENAME, or NULL if it cannot be opened.
+ */
+lstream *
+lstream_open_file (const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  lstream *s = lstream_open(filename, fd);
+  s->owned = 1;
+  return s;
+}
+
+void
+lstream_close (lstream *s)
+{
+  if (s->mapped) {
+    munmap(s->buffer, s->mapped);
+  } else {
+    free(s->buffer);
+  }
+  if (s->owned) {
+    close(s->fd);
+  }
+  free(s);
+}
+
+/*
+ * Read more input after the unread bytes, at least as many as are
+ * unread already, so that an expression read again after each call is
+ * read no more than twice over on average.
+ */
+void
+lstream_fill (lstream *s)
+{
+  long pending = s->end - s->start;
+  if (pending) {
+    memmove(s->buffer, s->buffer + s->start, pending);
+  }
+  s->start = 0;
+  s->end = pending;
+  if (s->capacity < 2 * pending || s->capacity < LSTREAM_CHUNK) {
+    s->capacity = max(2 * pending, LSTREAM_CHUNK);
+    s->buffer = realloc(s->buffer, s->capacity);
+  }
+
+  do {
+    long n = read(s->fd, s->buffer + s->end, s->capacity - s->end);
+    if (n <= 0) {
+      s->eof = 1;
+      break;
+    }
+    s->end += n;
+  } while (s->end < 2 * pending);
+}
+
+lreader
+lstream_reader (const lstream *s)
+{
+  const char *start = s->buffer + s->start;
+  lreader r = { s->name, start, start, s->buffer + s->end, s->line, s->col };
+  return r;
+}
+
+/*
+ * Mark the input up to the position of R as read.
+ */
+void
+lstream_advance (lstream *s, const lreader *r)
+{
+  for (const char *p = r->start; p < r->pos; p++) {
+    if (*p == '\n') {
+      s->line++;
+      s->col = 1;
+    } else {
+      s->col++;
+    }
+  }
+  s->start = r->pos - s->buffer;
+}
+
+lval *
+lstream_error (const lstream *s, const char *msg)
+{
+  lreader r = lstream_reader(s);
+  return lread_error(&r, msg);
+}
+
+/*
+ * Skip whitespace and comments. Returns 0 at end of input.
+ */
+int
+lstream_skip (lstream *s)
+{
+  while (1) {
+    lreader r = lstream_reader(s);
+    lread_skip(&r);
+    // A comment may go on in the input not read yet.
+    if (r.pos < r.end || s->eof) {
+      lstream_advance(s, &r);
+      return r.pos < r.end;
+    }
+    lstream_fill(s);
+  }
+}
+
+/*
+ * Return the next expression in S, or NULL at end of input.
+ */
+lval *
+lstream_read (lstream *s)
+{
+  if (!lstream_skip(s)) {
+    return NULL;
+  }
+  while (1) {
+    lreader r = lstream_reader(s);
+    lval *val = lread_sexp(&r);
+    // Reaching the end of the buffer, the expression may go on.
+    if (r.pos < r.end || s->eof) {
+      lstream_advance(s, &r);
+      return val;
+    }
+    lval_free(val);
+    lstream_fill(s);
+  }
+}
+
+/*
+ * Read the only expression in FILENAME.
+ */
+lval *
+lread_file (const char *filename)
+{
+  if (lreader_mpc) {
+    lparser *p = lparser_create();
+    return lread_mpc(p, lparser_parse_file(p, filename));
+  }
+
+  lstream *s = lstream_open_file(filename);
+  if (s == NULL) {
+    return lval_err("Unable to open file: %s", filename);
+  }
+  lval *val = lstream_read(s);
+  if (val == NULL) {
+    val = lstream_error(s, "expected expression");
+  } else if (lval_type(val) != LVAL_ERR && lstream_skip(s)) {
+    lval_free(val);
+    val = lstream_error(s, "expected end of input");
+  }
+  lstream_close(s);
+  return val;
+}
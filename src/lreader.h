@@ -0,0 +1,18 @@
+#ifndef LREADER_H
+#define LREADER_H
+
+#include "lval.h"
+
+typedef struct lstream lstream;
+
+extern int lreader_mpc;
+
+lval * lread      (const char *name, const char *s, long length);
+lval * lread_file (const char *filename);
+
+lstream * lstream_open      (const char *name, int fd);
+lstream * lstream_open_file (const char *filename);
+lval *    lstream_read      (lstream *s);
+void      lstream_close     (lstream *s);
+
+#endif
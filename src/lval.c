@@ -7,13 +7,22 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
 
 #include <string.h>
-extern char *strdup (const char *s);
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util.h"
+#include "lbig.h"
+#include "larray.h"
 #include "lval.h"
 #include "lparser.h"
+#include "lreader.h"
 
 char *
 ltype_name (ltype type)
@@ -24,13 +33,23 @@ ltype_name (ltype type)
   case LVAL_SYM:
     return "symbol";
   case LVAL_NUM:
-    return "number";
+    return "float";
+  case LVAL_INT:
+    return "integer";
+  case LVAL_BIG:
+    return "bignum";
+  case LVAL_ARR:
+    return "array";
+  case LVAL_VEC:
+    return "vector";
   case LVAL_LST:
     return "list";
   case LVAL_FUN:
     return "function";
   case LVAL_STR:
     return "string";
+  case LVAL_TAIL:
+    return "tail call";
   }
   return "unknown";
 }
@@ -38,11 +57,14 @@ ltype_name (ltype type)
 
 
 #define LVAL_ALLOC(_v_,_t_) \
-  lval *_v_ = malloc(sizeof(lval)); \
+  lval *_v_ = pool_alloc(&lval_pool); \
   _v_->type = _t_; \
+  _v_->refs = 1; \
   _v_->is_quoted = 0;
 
-#define LVAL_NUM_VALUE(_v_) *(float*)_v_->value
+#define LVAL_NUM_VALUE(_v_) (_v_)->num
+#define LVAL_INT_VALUE(_v_) (_v_)->integer
+#define LVAL_IS_NUMBER(_v_) ((_v_)->type == LVAL_INT || (_v_)->type == LVAL_NUM || (_v_)->type == LVAL_BIG)
 
 #define LVAL_ASSERT_TYPE(_v_,_t_) \
   if (_v_->type != _t_) { \
@@ -54,6 +76,13 @@ ltype_name (ltype type)
     LVAL_ASSERT_TYPE(lval_lst_nth(_v_, i), _t_);    \
   }
 
+#define LVAL_LST_ASSERT_NUMBER(_v_) \
+  for (long i = 0; i < lval_lst_length(_v_); i++) { \
+    if (!LVAL_IS_NUMBER(lval_lst_nth(_v_, i))) { \
+      return lval_err("Wrong type of argument: number, %s", ltype_name(lval_lst_nth(_v_, i)->type)); \
+    } \
+  }
+
 #define LVAL_ASSERT_NUMARG(_v_,_n_) \
   if (lval_lst_length(_v_) != _n_) { \
     return lval_err("Invalid number of arguments: %d, %d", _n_, lval_lst_length(_v_)); \
@@ -64,14 +93,35 @@ ltype_name (ltype type)
     return lval_err("Invalid number of arguments: >= %d, %d", _n_, lval_lst_length(_v_)); \
   }
 
+#define LVAL_ASSERT_NUMARG_LE(_v_,_n_) \
+  if (lval_lst_length(_v_) > _n_) { \
+    return lval_err("Invalid number of arguments: <= %d, %d", _n_, lval_lst_length(_v_)); \
+  }
+
 #define LVAL_IS_NIL(_v_) (_v_->type == LVAL_LST && lval_lst_length(_v_) == 0)
 
+/*
+ * Integers and floats are stored immediately in the value union, all
+ * other types point to their payload.
+ *
+ * Values are reference counted and shared. A value with more than one
+ * reference must not be modified; use lval_unshare() to obtain a
+ * private copy first. Vectors are the exception, they are modified in
+ * place and shared by their copies.
+ */
 typedef struct lval {
   ltype  type;
-  void  *value;
   int    is_quoted;
+  long   refs;
+  union {
+    void    *value;
+    double   num;
+    int64_t  integer;
+  };
 } lval;
 
+static MEM_THREAD mem_pool lval_pool = MEM_POOL(sizeof(lval));
+
 int
 lval_type (const lval *val)
 {
@@ -82,16 +132,16 @@ lval *
 lval_err (const char *fmt, ...)
 {
   LVAL_ALLOC(val, LVAL_ERR);
-  val->value = malloc(256);
+  char buf[256];
 
   va_list args;
   va_start(args, fmt);
 
-  vsnprintf(val->value, 255, fmt, args);
+  vsnprintf(buf, 255, fmt, args);
 
   va_end(args);
 
-  val->value = realloc(val->value, 1 + strlen(val->value));
+  val->value = mem_strdup(buf);
   return val;
 }
 
@@ -99,39 +149,324 @@ lval *
 lval_str (const char *value)
 {
   LVAL_ALLOC(val, LVAL_STR);
-  val->value = strdup(value);
+  val->value = mem_strdup(value);
+  return val;
+}
+
+/*
+ * Return string of the LENGTH bytes at VALUE, which need not be
+ * terminated.
+ */
+lval *
+lval_str_n (const char *value, long length)
+{
+  LVAL_ALLOC(val, LVAL_STR);
+  val->value = mem_strndup(value, length);
   return val;
 }
 
+/*
+ * Symbol names are interned, two symbols are equal iff their values
+ * are the same pointer.
+ */
 lval *
 lval_sym (const char *name)
 {
   LVAL_ALLOC(val, LVAL_SYM);
-  val->value = strdup(name);
+  val->value = (char*)string_intern(name);
+  return val;
+}
+
+lval *
+lval_sym_n (const char *name, long length)
+{
+  LVAL_ALLOC(val, LVAL_SYM);
+  val->value = (char*)string_intern_n(name, length);
   return val;
 }
 
 lval *
-lval_num (float value)
+lval_num (double value)
 {
   LVAL_ALLOC(val, LVAL_NUM);
-  val->value = malloc(sizeof(float));
-  memcpy(val->value, &value, sizeof(float));
+  val->num = value;
   return val;
 }
 
 lval *
-lval_num_compare (const lval *a, const lval *b)
+lval_int (int64_t value)
+{
+  LVAL_ALLOC(val, LVAL_INT);
+  val->integer = value;
+  return val;
+}
+
+/*
+ * Return integer B, an integer rather than a bignum if it fits in 64
+ * bits. Consumes B.
+ */
+lval *
+lval_big (lbig *b)
+{
+  int64_t n;
+  if (lbig_to_int(b, &n)) {
+    lbig_free(b);
+    return lval_int(n);
+  }
+  LVAL_ALLOC(val, LVAL_BIG);
+  val->value = b;
+  return val;
+}
+
+lval *
+lval_array (larray *a)
+{
+  LVAL_ALLOC(val, LVAL_ARR);
+  val->value = a;
+  return val;
+}
+
+/*
+ * Return the number in the LENGTH bytes at S: an integer if it has no
+ * fraction, a bignum if it does not fit, a float with a fraction.
+ */
+lval *
+lval_number (const char *s, long length)
+{
+  char buf[64];
+  char *str = (length < sizeof(buf)) ? buf : malloc(length + 1);
+  memcpy(str, s, length);
+  str[length] = 0;
+
+  lval *val;
+  if (memchr(str, '.', length) == NULL) {
+    errno = 0;
+    long long n = strtoll(str, NULL, 10);
+    val = (errno == ERANGE) ? lval_big(lbig_parse(str, length)) : lval_int(n);
+  } else {
+    val = lval_num(strtod(str, NULL));
+  }
+  if (str != buf) {
+    free(str);
+  }
+  return val;
+}
+
+typedef enum lprim {
+  PRIM_ADD, PRIM_SUB, PRIM_MUL, PRIM_DIV, PRIM_GT, PRIM_LT, PRIM_GE, PRIM_LE, PRIM_EQ
+} lprim;
+
+/*
+ * A number being computed, an integer or bignum as long as the result
+ * is exact. A bignum taken from a value is borrowed, one computed is
+ * owned until it is made a value or freed with lnum_free().
+ */
+typedef struct lnum {
+  ltype    type;
+  int64_t  integer;
+  double   num;
+  lbig    *big;
+  int      owned;
+} lnum;
+
+lnum
+lnum_of (const lval *val)
+{
+  lnum n = { val->type, 0, 0, NULL, 0 };
+  switch (val->type) {
+  case LVAL_NUM:
+    n.num = LVAL_NUM_VALUE(val);
+    break;
+  case LVAL_BIG:
+    n.big = val->value;
+    break;
+  default:
+    n.integer = LVAL_INT_VALUE(val);
+    break;
+  }
+  return n;
+}
+
+void
+lnum_free (lnum n)
+{
+  if (n.owned) {
+    lbig_free(n.big);
+  }
+}
+
+double
+lnum_float (lnum n)
+{
+  switch (n.type) {
+  case LVAL_NUM:
+    return n.num;
+  case LVAL_BIG:
+    return lbig_to_double(n.big);
+  default:
+    return (double)n.integer;
+  }
+}
+
+/*
+ * Return N as a value. Consumes N.
+ */
+lval *
+lnum_lval (lnum n)
+{
+  switch (n.type) {
+  case LVAL_NUM:
+    return lval_num(n.num);
+  case LVAL_BIG:
+    return lval_big(n.owned ? n.big : lbig_copy(n.big));
+  default:
+    return lval_int(n.integer);
+  }
+}
+
+/*
+ * Set *R to A op B for arithmetic primitive P, returns false if the
+ * result does not fit or, for division, is not an integer.
+ */
+static inline int
+lint_arith (lprim p, int64_t a, int64_t b, int64_t *r)
+{
+  switch (p) {
+  case PRIM_ADD: return !__builtin_add_overflow(a, b, r);
+  case PRIM_SUB: return !__builtin_sub_overflow(a, b, r);
+  case PRIM_MUL: return !__builtin_mul_overflow(a, b, r);
+  case PRIM_DIV:
+    if (b == 0 || (a == INT64_MIN && b == -1) || a % b != 0) {
+      return 0;
+    }
+    *r = a / b;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Set *A to *A op B for P addition, subtraction or multiplication of
+ * integers or bignums. The result is an integer again if it fits.
+ */
+void
+lbig_arith (lprim p, lnum *a, lnum b)
+{
+  lbig *x = (a->type == LVAL_BIG) ? a->big : lbig_from_int(a->integer);
+  lbig *y = (b.type == LVAL_BIG) ? b.big : lbig_from_int(b.integer);
+  lbig *r;
+  switch (p) {
+  case PRIM_ADD: r = lbig_add(x, y); break;
+  case PRIM_SUB: r = lbig_sub(x, y); break;
+  default:       r = lbig_mul(x, y); break;
+  }
+  if (a->type != LVAL_BIG || a->owned) {
+    lbig_free(x);
+  }
+  if (b.type != LVAL_BIG) {
+    lbig_free(y);
+  }
+
+  if (lbig_to_int(r, &a->integer)) {
+    lbig_free(r);
+    a->type = LVAL_INT;
+    a->big = NULL;
+    a->owned = 0;
+  } else {
+    a->type = LVAL_BIG;
+    a->big = r;
+    a->owned = 1;
+  }
+}
+
+/*
+ * Set *A to *A op B for arithmetic primitive P. Integers stay exact,
+ * as bignums when they overflow, unless they are divided. Returns false
+ * for an integer division by zero.
+ */
+int
+lnum_arith (lprim p, lnum *a, lnum b)
+{
+  int64_t r;
+  if (a->type == LVAL_INT && b.type == LVAL_INT && lint_arith(p, a->integer, b.integer, &r)) {
+    a->integer = r;
+    return 1;
+  }
+  if (a->type != LVAL_NUM && b.type != LVAL_NUM) {
+    if (p != PRIM_DIV) {
+      lbig_arith(p, a, b);
+      return 1;
+    }
+    if (b.type == LVAL_INT && b.integer == 0) {
+      return 0;
+    }
+  }
+
+  double x = lnum_float(*a);
+  double y = lnum_float(b);
+  lnum_free(*a);
+  switch (p) {
+  case PRIM_ADD: a->num = x + y; break;
+  case PRIM_SUB: a->num = x - y; break;
+  case PRIM_MUL: a->num = x * y; break;
+  case PRIM_DIV: a->num = x / y; break;
+  default: break;
+  }
+  a->type = LVAL_NUM;
+  a->big = NULL;
+  a->owned = 0;
+  return 1;
+}
+
+/*
+ * Return -1, 0 or 1 as A is less than, equal to or greater than B.
+ * Integers and bignums are compared exactly, otherwise both as floats.
+ */
+int
+lnum_compare (lnum a, lnum b)
 {
-  LVAL_ASSERT_TYPE(a, LVAL_NUM);
-  LVAL_ASSERT_TYPE(b, LVAL_NUM);
-  if (LVAL_NUM_VALUE(a) < LVAL_NUM_VALUE(b)) {
-    return lval_num(-1);
+  if (a.type == LVAL_INT && b.type == LVAL_INT) {
+    return (a.integer > b.integer) - (a.integer < b.integer);
+  }
+  if (a.type != LVAL_NUM && b.type != LVAL_NUM) {
+    lbig *x = (a.type == LVAL_BIG) ? a.big : lbig_from_int(a.integer);
+    lbig *y = (b.type == LVAL_BIG) ? b.big : lbig_from_int(b.integer);
+    int c = lbig_compare(x, y);
+    if (x != a.big) {
+      lbig_free(x);
+    }
+    if (y != b.big) {
+      lbig_free(y);
+    }
+    return c;
   }
-  if (LVAL_NUM_VALUE(b) < LVAL_NUM_VALUE(a)) {
-    return lval_num(1);
+  double x = lnum_float(a);
+  double y = lnum_float(b);
+  return (x > y) - (x < y);
+}
+
+lval *
+lval_num_compare (const lval *a, const lval *b)
+{
+  if (!LVAL_IS_NUMBER(a) || !LVAL_IS_NUMBER(b)) {
+    return lval_err("Wrong type of argument: number, %s", ltype_name(LVAL_IS_NUMBER(a) ? b->type : a->type));
   }
-  return lval_num(0);
+  return lval_int(lnum_compare(lnum_of(a), lnum_of(b)));
+}
+
+/*
+ * Return a tail call. Special forms return the expression they would
+ * evaluate last as a tail call, and the evaluator continues with it in
+ * the environment of the special form without growing the C stack.
+ * Consumes EXPR.
+ */
+lval *
+lval_tail (lval *expr)
+{
+  LVAL_ALLOC(val, LVAL_TAIL);
+  val->value = expr;
+  return val;
 }
 
 lval *
@@ -150,70 +485,311 @@ lval_fun_userdef (lenv *env, lval *args, lval *body)
   return val;
 }
 
+lval *
+lval_fun_closure (lenv *env, lval *args, lval *body, lcode *code, lvars *vars)
+{
+  LVAL_ALLOC(val, LVAL_FUN);
+  val->value = lfun_closure(env, args, body, code, vars);
+  return val;
+}
+
 int
 lval_fun_is_special (const lval *fun)
 {
   return lfun_is_special(fun->value);
 }
 
+/*
+ * Lists are persistent vectors. A list is a window into a reference
+ * counted store of members, which is shared by the lists derived from
+ * it: the tail of a list and a copy share the store of the source, so
+ * do cons and append as long as the store has room on that side of the
+ * window that no other list has claimed. Only then are the members
+ * copied to a new store.
+ */
+typedef struct lstore {
+  long   refs;
+  long   low;                   /* slots below low are unclaimed */
+  long   high;                  /* slots from high on are unclaimed */
+  long   capacity;
+  lval  *slots[];
+} lstore;
+
+typedef struct llist {
+  lstore *store;
+  long    start;
+  long    length;
+} llist;
+
+static MEM_THREAD mem_pool llist_pool = MEM_POOL(sizeof(llist));
+
+#define LST_MIN_ROOM 4
+
+lstore *
+lstore_create (long capacity, long low)
+{
+  lstore *store = mem_alloc(sizeof(lstore) + capacity * sizeof(lval*));
+  store->refs = 1;
+  store->low = low;
+  store->high = low;
+  store->capacity = capacity;
+  return store;
+}
+
+void
+lstore_free (lstore *store)
+{
+  if (--store->refs > 0) {
+    return;
+  }
+  for (long i = store->low; i < store->high; i++) {
+    lval_free(store->slots[i]);
+  }
+  mem_free(store, sizeof(lstore) + store->capacity * sizeof(lval*));
+}
+
+/*
+ * Move the members of LST to a new store with room for FRONT members
+ * before and BACK members after them.
+ */
+void
+llist_move (llist *lst, long front, long back)
+{
+  lstore *store = lstore_create(front + lst->length + back, front);
+  for (long i = 0; i < lst->length; i++) {
+    store->slots[store->high++] = lval_ref(lst->store->slots[lst->start + i]);
+  }
+  lstore_free(lst->store);
+  lst->store = store;
+  lst->start = front;
+}
+
+/*
+ * Return empty list with room for SIZE members.
+ */
 lval *
-lval_lst ()
+lval_lst_sized (long size)
 {
   LVAL_ALLOC(val, LVAL_LST);
-  val->value = list();
+  llist *lst = pool_alloc(&llist_pool);
+  lst->store = lstore_create(size, 0);
+  lst->start = 0;
+  lst->length = 0;
+  val->value = lst;
   return val;
 }
 
+lval *
+lval_lst ()
+{
+  return lval_lst_sized(0);
+}
+
+/*
+ * Append VAL to list LST, consumes VAL. Returns LST.
+ */
 lval *
 lval_lst_append (lval *lst, lval *val)
 {
   LVAL_ASSERT_TYPE(lst, LVAL_LST);
-  list_append(lst->value, val);
+  llist  *l = lst->value;
+  lstore *store = l->store;
+  if (l->start + l->length != store->high || store->high == store->capacity) {
+    llist_move(l, 0, max(l->length, LST_MIN_ROOM));
+    store = l->store;
+  }
+  store->slots[store->high++] = val;
+  l->length++;
   return lst;
 }
 
+/*
+ * Insert VAL in front of list LST, consumes VAL. Returns LST.
+ */
 lval *
 lval_lst_insert (lval *lst, lval *val)
 {
   LVAL_ASSERT_TYPE(lst, LVAL_LST);
-  list_insert(lst->value, val);
+  llist  *l = lst->value;
+  lstore *store = l->store;
+  if (l->start != store->low || store->low == 0) {
+    llist_move(l, max(l->length, LST_MIN_ROOM), 0);
+    store = l->store;
+  }
+  store->slots[--store->low] = val;
+  l->start--;
+  l->length++;
   return lst;
 }
 
 long
 lval_lst_length (const lval *lst)
 {
-  return list_length(lst->value);
+  return ((llist*)lst->value)->length;
 }
 
 lval *
 lval_lst_nth (const lval *lst, long pos)
 {
   LVAL_ASSERT_TYPE(lst, LVAL_LST);
-  if (pos >= lval_lst_length(lst)) {
-    return lval_err("Index out of range: %d, %d", lval_lst_length(lst), pos);
+  const llist *l = lst->value;
+  if (pos >= l->length) {
+    return lval_err("Index out of range: %d, %d", l->length, pos);
   }
-  return list_nth(lst->value, pos);
+  return l->store->slots[l->start + pos];
 }
 
+/*
+ * Remove member at POS from LST and return it.
+ */
 lval *
 lval_lst_take (lval *lst, long pos)
 {
   LVAL_ASSERT_TYPE(lst, LVAL_LST);
-  if (pos >= lval_lst_length(lst)) {
-    return lval_err("Index out of range: %d, %d", lval_lst_length(lst), pos);
+  llist *l = lst->value;
+  if (pos >= l->length) {
+    return lval_err("Index out of range: %d, %d", l->length, pos);
+  }
+  if (pos == 0) {
+    lstore *store = l->store;
+    lval *val = store->slots[l->start];
+    if (store->refs == 1 && l->start == store->low) {
+      // Nothing else sees the slot, hand its reference to the caller.
+      store->low++;
+    } else {
+      lval_ref(val);
+    }
+    l->start++;
+    l->length--;
+    return val;
+  }
+  if (l->store->refs > 1 || l->start != l->store->low || l->start + l->length != l->store->high) {
+    llist_move(l, 0, 0);
+  }
+  lstore *store = l->store;
+  lval *val = store->slots[l->start + pos];
+  memmove(&store->slots[l->start + pos], &store->slots[l->start + pos + 1],
+          (l->length - pos - 1) * sizeof(lval*));
+  store->high--;
+  l->length--;
+  return val;
+}
+
+/*
+ * Return a new list sharing the members of LST after the first N.
+ */
+lval *
+lval_lst_drop (const lval *lst, long n)
+{
+  LVAL_ASSERT_TYPE(lst, LVAL_LST);
+  const llist *src = lst->value;
+  n = min(max(n, 0), src->length);
+  LVAL_ALLOC(dst, LVAL_LST);
+  llist *l = pool_alloc(&llist_pool);
+  l->store = src->store;
+  l->store->refs++;
+  l->start = src->start + n;
+  l->length = src->length - n;
+  dst->value = l;
+  dst->is_quoted = lst->is_quoted;
+  return dst;
+}
+
+/*
+ * Vectors are growable arrays of values, modified in place. Since a
+ * vector can be made to hold itself, all live vectors are kept for the
+ * collector like environments.
+ */
+typedef struct lvector {
+  long     refs;
+  tlist   *members;
+  int      printing;            /* set while printed, to cut cycles */
+  lvector *gc_prev;             /* all live vectors, for the collector */
+  lvector *gc_next;
+} lvector;
+
+static MEM_THREAD mem_pool lvector_pool = MEM_POOL(sizeof(lvector));
+
+static lvector *lvector_all = NULL;
+
+/*
+ * Return empty vector with room for CAPACITY members.
+ */
+lvector *
+lvector_create (long capacity)
+{
+  lgc_maybe();
+
+  lvector *vec = pool_alloc(&lvector_pool);
+  vec->gc_prev = NULL;
+  vec->gc_next = lvector_all;
+  if (lvector_all) {
+    lvector_all->gc_prev = vec;
+  }
+  lvector_all = vec;
+  vec->refs = 1;
+  vec->members = list_sized(capacity);
+  vec->printing = 0;
+  return vec;
+}
+
+lvector *
+lvector_ref (lvector *vec)
+{
+  vec->refs++;
+  return vec;
+}
+
+/*
+ * Drop all members of VEC.
+ */
+void
+lvector_clear (lvector *vec)
+{
+  tlist *members = vec->members;
+  vec->members = list();
+  for (long i = 0; i < list_length(members); i++) {
+    lval_free(list_nth(members, i));
   }
-  return list_take(lst->value, pos);
+  list_free(members);
 }
 
 void
-lval_free_lst (lval *lst)
+lvector_free (lvector *vec)
 {
-  long length = list_length(lst->value);
-  for (long i = 0; i < length; i++) {
-    lval_free(list_nth(lst->value, i));
+  if (--vec->refs > 0) {
+    return;
+  }
+  if (vec->gc_prev) {
+    vec->gc_prev->gc_next = vec->gc_next;
+  } else {
+    lvector_all = vec->gc_next;
   }
-  list_free(lst->value);
+  if (vec->gc_next) {
+    vec->gc_next->gc_prev = vec->gc_prev;
+  }
+  lvector_clear(vec);
+  list_free(vec->members);
+  pool_free(&lvector_pool, vec);
+}
+
+/*
+ * Return value of vector VEC, consumes the reference to VEC.
+ */
+lval *
+lval_vector (lvector *vec)
+{
+  LVAL_ALLOC(val, LVAL_VEC);
+  val->value = vec;
+  return val;
+}
+
+void
+lval_free_lst (lval *lst)
+{
+  llist *l = lst->value;
+  lstore_free(l->store);
+  pool_free(&llist_pool, l);
 }
 
 void
@@ -222,30 +798,63 @@ lval_free_fun (lval *fun)
   lfun_free(fun->value);
 }
 
+lval *
+lval_ref (lval *val)
+{
+  val->refs++;
+  return val;
+}
+
 void
 lval_free (lval *val)
 {
+  if (--val->refs > 0) {
+    return;
+  }
+
   switch (val->type) {
   case LVAL_FUN:
     lval_free_fun(val);
     break;
   case LVAL_STR:
-  case LVAL_SYM:
   case LVAL_ERR:
+    mem_strfree(val->value);
+    break;
+  case LVAL_SYM:
   case LVAL_NUM:
-    free(val->value);
+  case LVAL_INT:
+    break;
+  case LVAL_BIG:
+    lbig_free(val->value);
+    break;
+  case LVAL_ARR:
+    larray_free(val->value);
+    break;
+  case LVAL_VEC:
+    lvector_free(val->value);
     break;
   case LVAL_LST:
     lval_free_lst(val);
     break;
+  case LVAL_TAIL:
+    lval_free(val->value);
+    break;
   }
 
-  free(val);
+  pool_free(&lval_pool, val);
 }
 
+/*
+ * Return a shallow copy of a value. Members of a list are shared with
+ * the source, a vector is the same vector.
+ */
 lval *
 lval_copy (const lval *src)
 {
+  if (src->type == LVAL_LST) {
+    return lval_lst_drop(src, 0);
+  }
+
   LVAL_ALLOC(dst, src->type);
 
   switch (src->type) {
@@ -253,26 +862,52 @@ lval_copy (const lval *src)
     dst->value = lfun_copy(src->value);
     break;
   case LVAL_STR:
-  case LVAL_SYM:
   case LVAL_ERR:
-    dst->value = strdup(src->value);
+    dst->value = mem_strdup(src->value);
+    break;
+  case LVAL_SYM:
+    dst->value = src->value;
     break;
   case LVAL_NUM:
-    dst->value = malloc(sizeof(float));
-    dst->value = memcpy(dst->value, src->value, sizeof(float));
+    dst->num = src->num;
     break;
-  case LVAL_LST:
-    dst->value = list();
-    for (long i = list_length(src->value) - 1; i >= 0; i--) {
-      list_insert(dst->value, lval_copy(list_nth(src->value, i)));
-    }
-    dst->is_quoted = src->is_quoted;
+  case LVAL_INT:
+    dst->integer = src->integer;
+    break;
+  case LVAL_BIG:
+    dst->value = lbig_copy(src->value);
+    break;
+  case LVAL_ARR:
+    dst->value = larray_copy(src->value);
+    break;
+  case LVAL_VEC:
+    dst->value = lvector_ref(src->value);
+    break;
+  case LVAL_LST:
+    break;
+  case LVAL_TAIL:
+    dst->value = lval_ref(src->value);
     break;
   }
 
   return dst;
 }
 
+/*
+ * Return a value that can be modified by the caller. Consumes the
+ * reference to VAL.
+ */
+lval *
+lval_unshare (lval *val)
+{
+  if (val->refs == 1) {
+    return val;
+  }
+  lval *dst = lval_copy(val);
+  lval_free(val);
+  return dst;
+}
+
 void
 lval_quote (lval *val)
 {
@@ -298,6 +933,44 @@ lval_print (const lval *val)
   case LVAL_NUM:
     printf("%G", LVAL_NUM_VALUE(val));
     break;
+  case LVAL_INT:
+    printf("%lld", (long long)LVAL_INT_VALUE(val));
+    break;
+  case LVAL_BIG: {
+    char *s = lbig_string(val->value);
+    printf("%s", s);
+    free(s);
+    break;
+  }
+  case LVAL_ARR: {
+    const larray *a = val->value;
+    printf("<%s-array", larray_kind_name(a->kind));
+    for (long i = 0; i < a->length; i++) {
+      if (a->kind == LARRAY_F64) {
+        printf(" %G", LARRAY_F64(a)[i]);
+      } else {
+        printf(" %lld", (long long)larray_int(a, i));
+      }
+    }
+    putchar('>');
+    break;
+  }
+  case LVAL_VEC: {
+    lvector *vec = val->value;
+    if (vec->printing) {
+      printf("<vector ...>");
+      break;
+    }
+    vec->printing = 1;
+    printf("<vector");
+    for (long i = 0; i < list_length(vec->members); i++) {
+      putchar(' ');
+      lval_print(list_nth(vec->members, i));
+    }
+    putchar('>');
+    vec->printing = 0;
+    break;
+  }
   case LVAL_STR:
     printf("\"%s\"", (char*)val->value);
     break;
@@ -310,6 +983,9 @@ lval_print (const lval *val)
   case LVAL_FUN:
     printf("<function>");
     break;
+  case LVAL_TAIL:
+    printf("<tail call>");
+    break;
   case LVAL_LST:
     if (LVAL_IS_NIL(val)) {
       printf("nil");
@@ -329,54 +1005,179 @@ lval_print (const lval *val)
 
 
 
+/*
+ * Names are interned strings. Small frames store their bindings in
+ * dense arrays that are scanned linearly; once a frame grows past
+ * LENV_ARRAY_MAX bindings the arrays become an open addressing hash
+ * table keyed by the name pointer.
+ */
+#define LENV_ARRAY_MAX 8
+
 typedef struct lenv {
-  lenv   *parent;
-  long    size;
-  char  **names;
-  lval  **lvals;
+  lenv        *parent;
+  long         refs;
+  long         size;
+  long         capacity;
+  const char **names;
+  lval       **lvals;
+  lenv        *gc_prev;         /* all live environments, for the collector */
+  lenv        *gc_next;
 } lenv;
 
+static MEM_THREAD mem_pool lenv_pool = MEM_POOL(sizeof(lenv));
+
+static lenv *lenv_all = NULL;
+
 lenv *
 lenv_create (lenv *parent)
 {
-  lenv *env = malloc(sizeof(lenv));
+  lgc_maybe();
+
+  lenv *env = pool_alloc(&lenv_pool);
+  env->gc_prev = NULL;
+  env->gc_next = lenv_all;
+  if (lenv_all) {
+    lenv_all->gc_prev = env;
+  }
+  lenv_all = env;
   env->size = 0;
+  env->capacity = 0;
   env->lvals = NULL;
   env->names = NULL;
-  env->parent = parent;
+  env->parent = parent ? lenv_ref(parent) : NULL;
+  env->refs = 1;
   return env;
 }
 
+/*
+ * Environments are reference counted. A frame is kept alive by its
+ * child frames, so closures can outlive the call that created them.
+ */
 lenv *
-lenv_copy (const lenv *src)
+lenv_ref (lenv *env)
 {
-  lenv *dst = lenv_create(src->parent);
-  for (long i = 0; i < src->size; i++) {
-    lenv_put(dst, src->names[i], src->lvals[i]);
-  }
-  return dst;
+  env->refs++;
+  return env;
 }
 
 /*
- * Put value into environment.
+ * Return slot of NAME, or the free slot it would be stored in.
  */
+long
+lenv_slot (const lenv *env, const char *name)
+{
+  if (env->capacity <= LENV_ARRAY_MAX) {
+    for (long i = 0; i < env->size; i++) {
+      if (env->names[i] == name) {
+        return i;
+      }
+    }
+    return env->size;
+  }
+
+  unsigned long mask = env->capacity - 1;
+  unsigned long pos = ((uintptr_t)name * 0x9E3779B97F4A7C15UL >> 32) & mask;
+  while (env->names[pos] && env->names[pos] != name) {
+    pos = (pos + 1) & mask;
+  }
+  return pos;
+}
+
+int
+lenv_is_full (const lenv *env)
+{
+  if (env->capacity <= LENV_ARRAY_MAX) {
+    return env->size == env->capacity;
+  }
+  return 2 * (env->size + 1) > env->capacity;
+}
+
 void
-lenv_put (lenv *env, const char *name, lval *val)
+lenv_resize (lenv *env)
 {
-  for (long i = 0; i < env->size; i++) {
-    if (strcmp(env->names[i], name) == 0) {
-      lval_free(env->lvals[i]);
-      env->lvals[i] = lval_copy(val);
-      return;
+  long capacity = env->capacity;
+  const char **names = env->names;
+  lval **lvals = env->lvals;
+
+  if (capacity < LENV_ARRAY_MAX) {
+    env->capacity = capacity ? 2 * capacity : 2;
+    env->names = mem_realloc(env->names, capacity * sizeof(char*), env->capacity * sizeof(char*));
+    env->lvals = mem_realloc(env->lvals, capacity * sizeof(lval*), env->capacity * sizeof(lval*));
+    memset(&env->names[capacity], 0, (env->capacity - capacity) * sizeof(char*));
+    return;
+  }
+
+  env->capacity = (capacity == LENV_ARRAY_MAX) ? 4 * capacity : 2 * capacity;
+  env->names = memset(mem_alloc(env->capacity * sizeof(char*)), 0, env->capacity * sizeof(char*));
+  env->lvals = mem_alloc(env->capacity * sizeof(lval*));
+  for (long i = 0; i < capacity; i++) {
+    if (names[i]) {
+      long pos = lenv_slot(env, names[i]);
+      env->names[pos] = names[i];
+      env->lvals[pos] = lvals[i];
     }
   }
+  mem_free(names, capacity * sizeof(char*));
+  mem_free(lvals, capacity * sizeof(lval*));
+}
+
+/*
+ * Put value into environment, NAME must be interned.
+ */
+void
+lenv_put_key (lenv *env, const char *name, lval *val)
+{
+  long pos = lenv_slot(env, name);
+
+  if (pos < env->capacity && env->names[pos] == name) {
+    lval *old = env->lvals[pos];
+    env->lvals[pos] = lval_ref(val);
+    lval_free(old);
+    return;
+  }
+
+  if (lenv_is_full(env)) {
+    lenv_resize(env);
+    pos = lenv_slot(env, name);
+  }
 
   env->size++;
-  env->names = realloc(env->names, env->size * sizeof(char*));
-  env->lvals = realloc(env->lvals, env->size * sizeof(lval*));
-  env->names[env->size - 1] = strdup(name);
-  env->lvals[env->size - 1] = lval_copy(val);
+  env->names[pos] = name;
+  env->lvals[pos] = lval_ref(val);
+}
+
+/*
+ * Return value from environment without taking a reference, or NULL
+ * if unbound. NAME must be interned.
+ */
+lval *
+lenv_get_key (lenv *env, const char *name)
+{
+  for (; env; env = env->parent) {
+    long pos = lenv_slot(env, name);
+    if (pos < env->capacity && env->names[pos] == name) {
+      return env->lvals[pos];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Put value into environment.
+ */
+void
+lenv_put (lenv *env, const char *name, lval *val)
+{
+  lenv_put_key(env, string_intern(name), val);
+}
 
+/*
+ * Bind symbol SYM to value.
+ */
+void
+lenv_put_sym (lenv *env, const lval *sym, lval *val)
+{
+  lenv_put_key(env, sym->value, val);
 }
 
 /*
@@ -385,17 +1186,29 @@ lenv_put (lenv *env, const char *name, lval *val)
 lval *
 lenv_get (lenv *env, const char *name)
 {
-  for (long i = 0; i < env->size; i++) {
-    if (strcmp(env->names[i], name) == 0) {
-      return lval_copy(env->lvals[i]);
-    }
-  }
-  if (env->parent) {
-    return lenv_get(env->parent, name);
+  // A name that was never interned is bound nowhere, looking it up
+  // must not intern it.
+  const char *key = string_interned(name);
+  lval *val = key ? lenv_get_key(env, key) : NULL;
+  if (val) {
+    return lval_ref(val);
   }
   return lval_err("Void variable: %s", name);
 }
 
+/*
+ * Return value bound to symbol SYM.
+ */
+lval *
+lenv_get_sym (lenv *env, const lval *sym)
+{
+  lval *val = lenv_get_key(env, sym->value);
+  if (val) {
+    return lval_ref(val);
+  }
+  return lval_err("Void variable: %s", (char*)sym->value);
+}
+
 /*
  * Register new builtin function.
  */
@@ -407,16 +1220,118 @@ lenv_register_builtin (lenv *env, const char *name, lbuiltin *builtin, int is_sp
   lval_free(fun);
 }
 
+typedef struct lbuiltin_def {
+  const char *name;
+  lbuiltin   *builtin;
+  int         is_special;
+} lbuiltin_def;
+
+/*
+ * The builtins of the global environment. Images refer to builtins by
+ * their position here.
+ */
+static const lbuiltin_def lbuiltins[] = {
+  { "identity", builtin_identity, 0 },
+  { "lambda", builtin_lambda, 1 },
+  { "equal", builtin_equal, 0 },
+  { "quote", builtin_quote, 1 },
+  { "eval", builtin_eval, 0 },
+  { "load", builtin_load, 0 },
+  { "head", builtin_head, 0 },
+  { "tail", builtin_tail, 0 },
+  { "cons", builtin_cons, 0 },
+  { "list", builtin_list, 0 },
+  { "join", builtin_join, 0 },
+  { "def", builtin_def, 1 },
+  { "not", builtin_not, 0 },
+  { "and", builtin_and, 1 },
+  { "or", builtin_or, 1 },
+  { ">", builtin_gt, 0 },
+  { "<", builtin_lt, 0 },
+  { "=", builtin_eq, 0 },
+  { "if", builtin_if, 1 },
+  { ">=", builtin_ge, 0 },
+  { "<=", builtin_le, 0 },
+  { "+", builtin_add, 0 },
+  { "-", builtin_sub, 0 },
+  { "*", builtin_mul, 0 },
+  { "/", builtin_div, 0 },
+  { "gc", builtin_gc, 0 },
+  { "gc-stats", builtin_gc_stats, 0 },
+  { "save-image", builtin_save_image, 0 },
+  { "write-fasl", builtin_write_fasl, 0 },
+  { "load-fasl", builtin_load_fasl, 0 },
+  { "apply", builtin_apply, 0 },
+  { "min", builtin_min, 0 },
+  { "max", builtin_max, 0 },
+  { "dot", builtin_dot, 0 },
+  { "f64-array", builtin_f64_array, 0 },
+  { "i64-array", builtin_i64_array, 0 },
+  { "u8-array", builtin_u8_array, 0 },
+  { "array-length", builtin_array_length, 0 },
+  { "array-ref", builtin_array_ref, 0 },
+  { "array-slice", builtin_array_slice, 0 },
+  { "array-map", builtin_array_map, 0 },
+  { "array-reduce", builtin_array_reduce, 0 },
+  { "read-array", builtin_read_array, 0 },
+  { "vector", builtin_vector, 0 },
+  { "nth", builtin_nth, 0 },
+  { "set-nth!", builtin_set_nth, 0 },
+  { "push!", builtin_push, 0 },
+  { "len", builtin_len, 0 },
+  { "slice", builtin_slice, 0 },
+};
+
+#define NR_OF_BUILTINS (sizeof(lbuiltins) / sizeof(lbuiltin_def))
+
+/*
+ * Register all builtins of the global environment.
+ */
+void
+lenv_register_builtins (lenv *env)
+{
+  for (long i = 0; i < NR_OF_BUILTINS; i++) {
+    lenv_register_builtin(env, lbuiltins[i].name, lbuiltins[i].builtin, lbuiltins[i].is_special);
+  }
+}
+
+/*
+ * Return position of BUILTIN in lbuiltins, or -1.
+ */
+long
+lbuiltin_index (lbuiltin *builtin)
+{
+  for (long i = 0; i < NR_OF_BUILTINS; i++) {
+    if (lbuiltins[i].builtin == builtin) {
+      return i;
+    }
+  }
+  return -1;
+}
+
 void
 lenv_free (lenv *env)
 {
-  for (long i = 0; i < env->size; i++) {
-    lval_free(env->lvals[i]);
-    free(env->names[i]);
+  while (env && --env->refs == 0) {
+    lenv *parent = env->parent;
+    if (env->gc_prev) {
+      env->gc_prev->gc_next = env->gc_next;
+    } else {
+      lenv_all = env->gc_next;
+    }
+    if (env->gc_next) {
+      env->gc_next->gc_prev = env->gc_prev;
+    }
+    for (long i = 0; i < env->capacity; i++) {
+      if (env->names[i]) {
+        lval_free(env->lvals[i]);
+      }
+    }
+    mem_free(env->names, env->capacity * sizeof(char*));
+    mem_free(env->lvals, env->capacity * sizeof(lval*));
+    pool_free(&lenv_pool, env);
+    env = parent;
   }
-  free(env->names);
-  free(env->lvals);
-  free(env);
 }
 
 
@@ -427,18 +1342,26 @@ typedef struct lfun {
   lbuiltin *builtin;
   lval     *body;
   lval     *args;
+  lcode    *code;
+  lvars    *vars;               /* captured locals of enclosing compiled lambdas */
   lenv     *env;
   int       is_special;
+  long      refs;
 } lfun;
 
+static MEM_THREAD mem_pool lfun_pool = MEM_POOL(sizeof(lfun));
+
 lfun *
 lfun_builtin (lbuiltin *builtin, int is_special)
 {
-  lfun *fun = malloc(sizeof(lfun));
+  lfun *fun = pool_alloc(&lfun_pool);
+  fun->refs = 1;
   fun->is_special = is_special;
   fun->builtin = builtin;
   fun->body = NULL;
   fun->args = NULL;
+  fun->code = NULL;
+  fun->vars = NULL;
   fun->env = NULL;
   return fun;
 }
@@ -446,39 +1369,58 @@ lfun_builtin (lbuiltin *builtin, int is_special)
 lfun *
 lfun_userdef (lenv *env, lval *args, lval *body)
 {
-  lfun *fun = malloc(sizeof(lfun));
+  lcode *code = lcode_enabled ? lcode_compile(env, args, body) : NULL;
+  return lfun_closure(env, args, body, code, NULL);
+}
+
+/*
+ * Create function with compiled CODE closing over the variables VARS,
+ * both may be NULL. Consumes CODE and VARS. The function shares ENV,
+ * it is not copied.
+ */
+lfun *
+lfun_closure (lenv *env, lval *args, lval *body, lcode *code, lvars *vars)
+{
+  lfun *fun = pool_alloc(&lfun_pool);
+  fun->refs = 1;
   fun->is_special = 0;
   fun->builtin = NULL;
-  fun->body = lval_copy(body);
-  fun->args = lval_copy(args);
-  fun->env = lenv_create(env);
+  fun->body = lval_ref(body);
+  fun->args = lval_ref(args);
+  fun->code = code;
+  fun->vars = vars;
+  fun->env = lenv_ref(env);
   return fun;
 }
 
+/*
+ * Functions are immutable, a copy shares the source.
+ */
 lfun *
 lfun_copy (lfun *src)
 {
-  if (src->builtin) {
-    return lfun_builtin(src->builtin, src->is_special);
-  }
-  lfun *dst = malloc(sizeof(lfun));
-  dst->builtin = NULL;
-  dst->is_special = 0;
-  dst->args = lval_copy(src->args);
-  dst->body = lval_copy(src->body);
-  dst->env  = lenv_copy(src->env);
-  return dst;
+  src->refs++;
+  return src;
 }
 
 void
 lfun_free (lfun *fun)
 {
+  if (--fun->refs > 0) {
+    return;
+  }
   if (fun->builtin == NULL) {
     lval_free(fun->body);
     lval_free(fun->args);
     lenv_free(fun->env);
+    if (fun->code) {
+      lcode_free(fun->code);
+    }
+    if (fun->vars) {
+      lvars_free(fun->vars);
+    }
   }
-  free(fun);
+  pool_free(&lfun_pool, fun);
 }
 
 int
@@ -487,17 +1429,21 @@ lfun_is_special (const lfun *fun)
   return fun->is_special;
 }
 
+/*
+ * Bind the formal arguments of user defined function F in frame FENV.
+ * Returns NULL on success, an error otherwise.
+ */
 lval *
-lval_fun_call (lenv *env, lval *fun, lval *arg)
+lfun_bind (lfun *f, lenv *fenv, lval *arg)
 {
-  lfun *f = (lfun*)fun->value;
-  if (f->builtin) {
-    return f->builtin(env, arg);
+  static const char *rest_key = NULL;
+  if (rest_key == NULL) {
+    rest_key = string_intern("&rest");
   }
 
   long restpos = 0;
   for (long i = 0; i < lval_lst_length(f->args); i++) {
-    if (strcmp(lval_lst_nth(f->args, i)->value, "&rest") == 0) {
+    if (lval_lst_nth(f->args, i)->value == rest_key) {
       break;
     }
     restpos++;
@@ -505,31 +1451,51 @@ lval_fun_call (lenv *env, lval *fun, lval *arg)
 
   LVAL_ASSERT_NUMARG_GE(arg, restpos);
 
-  lval *body = lval_copy(f->body);
-  lenv *fenv = lenv_create(f->env);
-
   // bind the formal arguments
   for (long i = 0; i < restpos; i++) {
-    lenv_put(fenv, lval_lst_nth(f->args, i)->value, lval_lst_nth(arg, i));
+    lenv_put_sym(fenv, lval_lst_nth(f->args, i), lval_lst_nth(arg, i));
   }
 
   if (restpos < lval_lst_length(arg)) {
     lval *rest = lval_lst();
     for (long i = restpos; i < lval_lst_length(arg); i++) {
-      rest = lval_lst_append(rest, lval_copy(lval_lst_nth(arg, i)));
+      rest = lval_lst_append(rest, lval_ref(lval_lst_nth(arg, i)));
     }
     restpos++;
-    lenv_put(fenv, lval_lst_nth(f->args, restpos)->value, rest);
+    lenv_put_sym(fenv, lval_lst_nth(f->args, restpos), rest);
     lval_free(rest);
   }
   for (long i = 1 + restpos; i < lval_lst_length(f->args); i++) {
     lval *rest = lval_lst();
-    lenv_put(fenv, lval_lst_nth(f->args, i)->value, rest);
+    lenv_put_sym(fenv, lval_lst_nth(f->args, i), rest);
     lval_free(rest);
   }
 
-  lval_unquote(body);
-  lval *ret = lval_eval(fenv, body);
+  return NULL;
+}
+
+lval *
+lval_fun_call (lenv *env, lval *fun, lval *arg)
+{
+  lfun *f = (lfun*)fun->value;
+  if (f->builtin) {
+    lval *ret = f->builtin(env, arg);
+    if (ret->type == LVAL_TAIL) {
+      lval *expr = lval_ref(ret->value);
+      lval_free(ret);
+      return lval_eval(env, expr);
+    }
+    return ret;
+  }
+  if (f->code) {
+    return lcode_call(f, arg);
+  }
+
+  lenv *fenv = lenv_create(f->env);
+  lval *ret = lfun_bind(f, fenv, arg);
+  if (ret == NULL) {
+    ret = lval_eval_unquoted(fenv, lval_ref(f->body));
+  }
   lenv_free(fenv);
   return ret;
 }
@@ -540,74 +1506,157 @@ lval *
 builtin_identity (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 1);
-  return lval_copy(lval_lst_nth(arg, 0));
+  return lval_ref(lval_lst_nth(arg, 0));
+}
+
+/*
+ * Return the numbers in ARG combined left to right with arithmetic
+ * primitive P, checking their types in the same pass.
+ */
+lval *
+lnum_fold (lprim p, const lval *arg)
+{
+  const llist *l = arg->value;
+  lval **slots = l->store->slots + l->start;
+  lnum acc = { LVAL_INT, 0, 0, NULL, 0 };
+  for (long i = 0; i < l->length; i++) {
+    if (!LVAL_IS_NUMBER(slots[i])) {
+      lnum_free(acc);
+      return lval_err("Wrong type of argument: number, %s", ltype_name(slots[i]->type));
+    }
+    if (i == 0) {
+      acc = lnum_of(slots[i]);
+    } else if (!lnum_arith(p, &acc, lnum_of(slots[i]))) {
+      lnum_free(acc);
+      return lval_err("Division by zero");
+    }
+  }
+  return lnum_lval(acc);
+}
+
+lval *lval_array_reduce (lprim p, const larray *a);
+
+/*
+ * Return the array in ARG if it is the only argument, otherwise NULL.
+ */
+const larray *
+lval_only_array (const lval *arg)
+{
+  if (lval_lst_length(arg) == 1 && lval_lst_nth(arg, 0)->type == LVAL_ARR) {
+    return lval_lst_nth(arg, 0)->value;
+  }
+  return NULL;
 }
 
 lval *
 builtin_add (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG_GE(arg, 1);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
-
-  float sum = 0;
-  for (long i = 0; i < lval_lst_length(arg); i++) {
-    sum += LVAL_NUM_VALUE(lval_lst_nth(arg, i));
+  const larray *a = lval_only_array(arg);
+  if (a) {
+    return lval_array_reduce(PRIM_ADD, a);
   }
-  return lval_num(sum);
+  return lnum_fold(PRIM_ADD, arg);
 }
 
 lval *
 builtin_sub (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG_GE(arg, 1);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
+  LVAL_LST_ASSERT_NUMBER(arg);
 
-  float dif;
+  lnum dif = lnum_of(lval_lst_nth(arg, 0));
 
   if (lval_lst_length(arg) > 1) {
-    dif = LVAL_NUM_VALUE(lval_lst_nth(arg, 0));
-
     for (long i = 1; i < lval_lst_length(arg); i++) {
-      dif -= LVAL_NUM_VALUE(lval_lst_nth(arg, i));
+      lnum_arith(PRIM_SUB, &dif, lnum_of(lval_lst_nth(arg, i)));
     }
   } else {
-    dif = 0 - LVAL_NUM_VALUE(lval_lst_nth(arg, 0));
+    lnum zero = { LVAL_INT, 0, 0, NULL, 0 };
+    lnum_arith(PRIM_SUB, &zero, dif);
+    dif = zero;
   }
 
-  return lval_num(dif);
+  return lnum_lval(dif);
 }
 
 lval *
 builtin_mul (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG_GE(arg, 1);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
-
-  float mul = LVAL_NUM_VALUE(lval_lst_nth(arg, 0));
-
-  for (long i = 1; i < lval_lst_length(arg); i++) {
-    mul *= LVAL_NUM_VALUE(lval_lst_nth(arg, i));
+  const larray *a = lval_only_array(arg);
+  if (a) {
+    return lval_array_reduce(PRIM_MUL, a);
   }
-
-  return lval_num(mul);
+  return lnum_fold(PRIM_MUL, arg);
 }
 
 lval *
 builtin_div (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG_GE(arg, 1);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
+  LVAL_LST_ASSERT_NUMBER(arg);
+
+  lnum quo = lnum_of(lval_lst_nth(arg, 0));
+  if (lval_lst_length(arg) == 1 && lnum_float(quo) == 0) {
+      return lval_err("Division by zero");
+  }
 
-  float quo = LVAL_NUM_VALUE(lval_lst_nth(arg, 0));
-  if (lval_lst_length(arg) == 1 && quo == 0) {
+  for (long i = 1; i < lval_lst_length(arg); i++) {
+    if (!lnum_arith(PRIM_DIV, &quo, lnum_of(lval_lst_nth(arg, i)))) {
+      lnum_free(quo);
       return lval_err("Division by zero");
+    }
+  }
+
+  return lnum_lval(quo);
+}
+
+/*
+ * Return the least number in ARG if ORDER is -1, the greatest if 1.
+ */
+lval *
+lnum_extreme (const lval *arg, int order)
+{
+  const larray *a = lval_only_array(arg);
+  if (a) {
+    return lval_array_reduce(order < 0 ? PRIM_LT : PRIM_GT, a);
   }
 
+  LVAL_LST_ASSERT_NUMBER(arg);
+  long best = 0;
   for (long i = 1; i < lval_lst_length(arg); i++) {
-    quo /= LVAL_NUM_VALUE(lval_lst_nth(arg, i));
+    if (lnum_compare(lnum_of(lval_lst_nth(arg, i)), lnum_of(lval_lst_nth(arg, best))) == order) {
+      best = i;
+    }
   }
+  return lval_ref(lval_lst_nth(arg, best));
+}
+
+lval *
+builtin_min (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG_GE(arg, 1);
+  return lnum_extreme(arg, -1);
+}
+
+lval *
+builtin_max (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG_GE(arg, 1);
+  return lnum_extreme(arg, 1);
+}
 
-  return lval_num(quo);
+/*
+ * Call a function with the members of a list as its arguments.
+ */
+lval *
+builtin_apply (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_FUN);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 1), LVAL_LST);
+  return lval_fun_call(env, lval_lst_nth(arg, 0), lval_lst_nth(arg, 1));
 }
 
 lval *
@@ -619,7 +1668,7 @@ builtin_head (lenv *env, lval *arg)
   if (lval_lst_length(lst) == 0) {
     return lval_err("Cannot return head of an empty list");
   }
-  return lval_copy(lval_lst_nth(lst, 0));
+  return lval_ref(lval_lst_nth(lst, 0));
 }
 
 lval *
@@ -631,9 +1680,20 @@ builtin_tail (lenv *env, lval *arg)
   if (lval_lst_length(lst) == 0) {
     return lval_err("Cannot return tail of an empty list");
   }
-  lval *cdr = lval_copy(lst);
-  lval_lst_take(cdr, 0);
-  return cdr;
+  return lval_lst_drop(lst, 1);
+}
+
+/*
+ * Return list of the first argument followed by the members of the
+ * second, sharing them.
+ */
+lval *
+builtin_cons (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 1), LVAL_LST);
+  lval *lst = lval_copy(lval_lst_nth(arg, 1));
+  return lval_lst_insert(lst, lval_ref(lval_lst_nth(arg, 0)));
 }
 
 lval *
@@ -641,25 +1701,29 @@ builtin_eval (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 1);
   LVAL_LST_ASSERT_TYPE(arg, LVAL_LST);
-  lval *lst = lval_copy(lval_lst_nth(arg, 0));
+  lval *lst = lval_unshare(lval_ref(lval_lst_nth(arg, 0)));
   lval_unquote(lst);
-  return lval_eval(env, lst);
+  return lval_tail(lst);
 }
 
 lval *
 builtin_list (lenv *env, lval *arg)
 {
-  return lval_copy(arg);
+  return lval_ref(arg);
 }
 
 lval *
 builtin_join (lenv *env, lval *arg)
 {
   LVAL_LST_ASSERT_TYPE(arg, LVAL_LST);
-  lval *lst = lval_lst();
+  long size = 0;
+  for (long j = 0; j < lval_lst_length(arg); j++) {
+    size += lval_lst_length(lval_lst_nth(arg, j));
+  }
+  lval *lst = lval_lst_sized(size);
   for (long j = 0; j < lval_lst_length(arg); j++) {
     for (long i = 0; i < lval_lst_length(lval_lst_nth(arg, j)); i++) {
-      lval_lst_append(lst, lval_copy(lval_lst_nth(lval_lst_nth(arg, j), i)));
+      lval_lst_append(lst, lval_ref(lval_lst_nth(lval_lst_nth(arg, j), i)));
     }
   }
   return lst;
@@ -671,11 +1735,11 @@ builtin_def (lenv *env, lval *arg)
   LVAL_ASSERT_NUMARG_GE(arg, 2);
   LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_SYM);
   lval *sym = lval_lst_nth(arg, 0);
-  lval *val = lval_eval(env, lval_lst_take(arg, 1));
+  lval *val = lval_eval(env, lval_ref(lval_lst_nth(arg, 1)));
   if (val->type == LVAL_ERR) {
     return val;
   }
-  lenv_put(env, sym->value, val);
+  lenv_put_sym(env, sym, val);
   return val;
 }
 
@@ -695,36 +1759,34 @@ lval *
 builtin_quote (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 1);
-  lval_quote(lval_lst_nth(arg, 0));
-  return lval_lst_take(arg, 0);
+  lval *val = lval_unshare(lval_ref(lval_lst_nth(arg, 0)));
+  lval_quote(val);
+  return val;
 }
 
 lval *
 builtin_if (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 3);
-  lval *cond = lval_eval(env, lval_lst_take(arg, 0));
+  lval *cond = lval_eval(env, lval_ref(lval_lst_nth(arg, 0)));
   if (cond->type == LVAL_ERR) {
     return cond;
   }
-  if (LVAL_IS_NIL(cond)) {
-    lval_free(cond);
-    return lval_eval(env, lval_lst_take(arg, 1));
-  }
+  long branch = LVAL_IS_NIL(cond) ? 2 : 1;
   lval_free(cond);
-  return lval_eval(env, lval_lst_take(arg, 0));
+  return lval_tail(lval_ref(lval_lst_nth(arg, branch)));
 }
 
 lval *
 builtin_gt (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 2);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
+  LVAL_LST_ASSERT_NUMBER(arg);
   lval *ord = lval_num_compare(lval_lst_nth(arg, 0), lval_lst_nth(arg, 1));
   if (ord->type == LVAL_ERR) {
     return ord;
   }
-  if (LVAL_NUM_VALUE(ord) == 1) {
+  if (LVAL_INT_VALUE(ord) == 1) {
     lval_free(ord);
     return LVAL_T();
   }
@@ -736,12 +1798,12 @@ lval *
 builtin_lt (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 2);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
+  LVAL_LST_ASSERT_NUMBER(arg);
   lval *ord = lval_num_compare(lval_lst_nth(arg, 0), lval_lst_nth(arg, 1));
   if (ord->type == LVAL_ERR) {
     return ord;
   }
-  if (LVAL_NUM_VALUE(ord) == -1) {
+  if (LVAL_INT_VALUE(ord) == -1) {
     lval_free(ord);
     return LVAL_T();
   }
@@ -783,12 +1845,12 @@ lval *
 builtin_eq (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG(arg, 2);
-  LVAL_LST_ASSERT_TYPE(arg, LVAL_NUM);
+  LVAL_LST_ASSERT_NUMBER(arg);
   lval *ord = lval_num_compare(lval_lst_nth(arg, 0), lval_lst_nth(arg, 1));
   if (ord->type == LVAL_ERR) {
     return ord;
   }
-  if (LVAL_NUM_VALUE(ord) == 0) {
+  if (LVAL_INT_VALUE(ord) == 0) {
     lval_free(ord);
     return LVAL_T();
   }
@@ -809,15 +1871,54 @@ builtin_equal (lenv *env, lval *arg)
         return LVAL_T();
       }
       break;
+    case LVAL_INT:
+      if (LVAL_INT_VALUE(a) == LVAL_INT_VALUE(b)) {
+        return LVAL_T();
+      }
+      break;
+    case LVAL_BIG:
+      if (lbig_compare(a->value, b->value) == 0) {
+        return LVAL_T();
+      }
+      break;
+    case LVAL_SYM:
+      if (a->value == b->value) {
+        return LVAL_T();
+      }
+      break;
     case LVAL_STR:
     case LVAL_ERR:
-    case LVAL_SYM:
       if (strcmp(a->value, b->value) == 0) {
         return LVAL_T();
       }
       break;
+    case LVAL_ARR: {
+      const larray *x = a->value;
+      const larray *y = b->value;
+      if (x->kind != y->kind || x->length != y->length) {
+        break;
+      }
+      long i = 0;
+      if (x->kind == LARRAY_F64) {
+        while (i < x->length && LARRAY_F64(x)[i] == LARRAY_F64(y)[i]) {
+          i++;
+        }
+      } else if (memcmp(x->data, y->data, x->length * larray_kind_size(x->kind)) == 0) {
+        i = x->length;
+      }
+      if (i == x->length) {
+        return LVAL_T();
+      }
+      break;
+    }
+    case LVAL_VEC:
+      if (a->value == b->value) {
+        return LVAL_T();
+      }
+      break;
     case LVAL_FUN:
     case LVAL_LST:
+    case LVAL_TAIL:
       break;
     }
   }
@@ -839,20 +1940,14 @@ builtin_and (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG_GE(arg, 1);
   long length = lval_lst_length(arg);
-  lval *val;
-  for (long i = 0; i < length; i++) {
-    val = lval_eval(env, lval_lst_take(arg, 0));
-    if (val->type == LVAL_ERR) {
-      break;
-    }
-    if (LVAL_IS_NIL(val)) {
-      break;
-    }
-    if (i < length - 1) {
-      lval_free(val);
+  for (long i = 0; i < length - 1; i++) {
+    lval *val = lval_eval(env, lval_ref(lval_lst_nth(arg, i)));
+    if (val->type == LVAL_ERR || LVAL_IS_NIL(val)) {
+      return val;
     }
+    lval_free(val);
   }
-  return val;
+  return lval_tail(lval_ref(lval_lst_nth(arg, length - 1)));
 }
 
 lval *
@@ -860,36 +1955,31 @@ builtin_or (lenv *env, lval *arg)
 {
   LVAL_ASSERT_NUMARG_GE(arg, 1);
   long length = lval_lst_length(arg);
-  lval *val;
-  for (long i = 0; i < length; i++) {
-    val = lval_eval(env, lval_lst_take(arg, 0));
-    if (val->type == LVAL_ERR) {
-      break;
-    }
-    if (!LVAL_IS_NIL(val)) {
-      break;
-    }
-    if (i < length - 1) {
-      lval_free(val);
+  for (long i = 0; i < length - 1; i++) {
+    lval *val = lval_eval(env, lval_ref(lval_lst_nth(arg, i)));
+    if (val->type == LVAL_ERR || !LVAL_IS_NIL(val)) {
+      return val;
     }
+    lval_free(val);
   }
-  return val;
+  return lval_tail(lval_ref(lval_lst_nth(arg, length - 1)));
 }
 
 
 
 /*
- * Evaluate all members of a list.
+ * Evaluate the members of a list starting at position START. The list
+ * itself is not modified.
  */
 lval *
-lval_eval_lst (lenv *env, lval *val)
+lval_eval_lst_from (lenv *env, const lval *val, long start)
 {
   LVAL_ASSERT_TYPE(val, LVAL_LST);
-  lval *lst = lval_lst();
   long size = lval_lst_length(val);
+  lval *lst = lval_lst_sized(max(0, size - start));
 
-  for (long i = 0; i < size; i++) {
-    lval *mem = lval_eval(env, lval_lst_take(val, 0));
+  for (long i = start; i < size; i++) {
+    lval *mem = lval_eval(env, lval_ref(lval_lst_nth(val, i)));
     if (mem->type == LVAL_ERR) {
       lval_free(lst);
       return mem;
@@ -899,49 +1989,118 @@ lval_eval_lst (lenv *env, lval *val)
   return lst;
 }
 
+/*
+ * Evaluate all members of a list.
+ */
 lval *
-lval_eval_fun (lenv *env, lval *val)
+lval_eval_lst (lenv *env, lval *val)
 {
-  lval *fun = lval_eval(env, lval_lst_take(val, 0));
-  if (fun->type != LVAL_FUN) {
-    lval_free(fun);
-    return lval_err("Invalid function");
-  }
+  return lval_eval_lst_from(env, val, 0);
+}
 
-  lval *lst;
+/*
+ * Evaluate VAL. Calls in tail position, i.e. the body of a user
+ * defined function and tail calls returned by special forms, loop
+ * instead of recursing, so iteration by recursion runs in constant C
+ * stack. If UNQUOTED is set, VAL is evaluated even if it is quoted.
+ */
+lval *
+lval_eval_loop (lenv *env, lval *val, int unquoted)
+{
+  lenv *frame = NULL;
+  lval *dst;
 
-  if (lval_fun_is_special(fun)) {
-    lst = lval_copy(val);
-  } else {
-    lst = lval_eval_lst(env, val);
-    if (lst->type == LVAL_ERR) {
+  while (1) {
+    if (val->type == LVAL_SYM) {
+      dst = lenv_get_sym(env, val);
+      lval_free(val);
+      break;
+    }
+    if (val->type != LVAL_LST || lval_lst_length(val) == 0 || (lval_is_quoted(val) && !unquoted)) {
+      dst = val;
+      break;
+    }
+
+    lval *fun = lval_eval(env, lval_ref(lval_lst_nth(val, 0)));
+    if (fun->type != LVAL_FUN) {
+      lval_free(fun);
+      lval_free(val);
+      dst = lval_err("Invalid function");
+      break;
+    }
+
+    lval *arg;
+    if (lval_fun_is_special(fun)) {
+      arg = lval_lst_drop(val, 1);
+      lval_unquote(arg);
+    } else {
+      arg = lval_eval_lst_from(env, val, 1);
+    }
+    lval_free(val);
+    if (arg->type == LVAL_ERR) {
+      lval_free(fun);
+      dst = arg;
+      break;
+    }
+
+    lfun *f = fun->value;
+    if (f->builtin) {
+      dst = f->builtin(env, arg);
+      lval_free(arg);
+      lval_free(fun);
+      if (dst->type != LVAL_TAIL) {
+        break;
+      }
+      val = lval_ref(dst->value);
+      lval_free(dst);
+      unquoted = 0;
+      continue;
+    }
+
+    if (f->code) {
+      dst = lcode_call(f, arg);
+      lval_free(arg);
+      lval_free(fun);
+      break;
+    }
+
+    lenv *fenv = lenv_create(f->env);
+    dst = lfun_bind(f, fenv, arg);
+    lval_free(arg);
+    if (dst) {
+      lenv_free(fenv);
       lval_free(fun);
-      return lst;
+      break;
+    }
+
+    val = lval_ref(f->body);
+    lval_free(fun);
+    if (frame) {
+      lenv_free(frame);
     }
+    env = frame = fenv;
+    unquoted = 1;
   }
 
-  lval *dst = lval_fun_call(env, fun, lst);
-  lval_free(lst);
-  lval_free(fun);
+  if (frame) {
+    lenv_free(frame);
+  }
   return dst;
 }
 
 lval *
 lval_eval (lenv *env, lval *val)
 {
-  if (val->type == LVAL_SYM) {
-    lval *dst = lenv_get(env, val->value);
-    lval_free(val);
-    return dst;
-  }
-  if (val->type == LVAL_LST && lval_lst_length(val) && !lval_is_quoted(val)) {
-    lval *dst = lval_eval_fun(env, val);
-    lval_free(val);
-    return dst;
-  }
-  lval *dst = lval_copy(val);
-  lval_free(val);
-  return dst;
+  return lval_eval_loop(env, val, 0);
+}
+
+/*
+ * Evaluate a value as if it was not quoted.
+ */
+lval *
+lval_eval_unquoted (lenv *env, lval *val)
+{
+  return lval_eval_loop(env, val, 1);
 }
 
 lval *
@@ -957,7 +2116,7 @@ read_lval (mpc_ast_t *node)
     return val;
   }
   if (strstr(node->tag, "number")) {
-    return lval_num(atof(node->contents));
+    return lval_number(node->contents, strlen(node->contents));
   }
   if (strstr(node->tag, "symbol")) {
     if (strcmp(node->contents, "nil") == 0) {
@@ -966,7 +2125,7 @@ read_lval (mpc_ast_t *node)
     return lval_sym(node->contents);
   }
   if (strstr(node->tag, "list")) {
-    lval *lst = lval_lst();
+    lval *lst = lval_lst_sized(node->children_num - 2);
     if (strcmp(node->children[0]->contents, "{") == 0) {
       lval_quote(lst);
     }
@@ -987,19 +2146,2788 @@ builtin_load (lenv *env, lval *val)
   LVAL_ASSERT_NUMARG(val, 1);
   LVAL_LST_ASSERT_TYPE(val, LVAL_STR);
 
-  lval *expr;
   char *filename = lval_lst_nth(val, 0)->value;
 
-  lparser *p = lparser_create();
-  if (lparser_parse_file(p, filename)) {
-    expr = lval_eval(env, read_lval(lparser_ast(p)));
-    lparser_ast_delete(p);
+  if (lreader_mpc) {
+    lval *expr = lread_file(filename);
+    if (expr->type == LVAL_ERR) {
+      lval *err = lval_err("Error loading library %s", (char*)expr->value);
+      lval_free(expr);
+      return err;
+    }
+    return lval_eval(env, expr);
+  }
+
+  // Evaluate each expression as soon as it is read, returning the last.
+  lstream *s = lstream_open_file(filename);
+  if (s == NULL) {
+    return lval_err("Error loading library Unable to open file: %s", filename);
+  }
+  lval *result = LVAL_NIL();
+  lval *expr;
+  while ((expr = lstream_read(s))) {
+    lval_free(result);
+    if (expr->type == LVAL_ERR) {
+      result = lval_err("Error loading library %s", (char*)expr->value);
+      lval_free(expr);
+      break;
+    }
+    result = lval_eval(env, expr);
+    if (result->type == LVAL_ERR) {
+      break;
+    }
+  }
+  lstream_close(s);
+  return result;
+}
+
+
+
+/*
+ * Compiler and virtual machine for user defined functions.
+ *
+ * When a lambda is created its body is compiled to bytecode for a
+ * stack machine. Parameters are resolved to local slots, parameters of
+ * enclosing lambdas to a (depth, index) pair into the captured
+ * variables of the closure, and all other symbols are looked up in the
+ * environment of the function at run time. Special forms are resolved
+ * when the lambda is created; if, and, or, quote and lambda are
+ * compiled inline, guarded on their symbol still being bound to them,
+ * a body using any other special form, eval or load is not compiled
+ * and runs in the tree-walking evaluator.
+ */
+
+int lcode_enabled = 1;
+
+typedef enum lop {
+  OP_CONST,                     /* k:   push constant k */
+  OP_LOCAL,                     /* i:   push local slot i */
+  OP_OUTER,                     /* d i: push slot i of the captured variables at depth d */
+  OP_CLOSURE,                   /* c k: push closure of code c, constant k is the form */
+  OP_GLOBAL,                    /* k:   push value of symbol constant k */
+  OP_CALL,                      /* n:   call with n arguments */
+  OP_TAILCALL,                  /* n:   call in tail position */
+  OP_SPECIAL,                   /* k a: if the function on top is special, apply it to
+                                        form k unevaluated and continue at a */
+  OP_BOUND,                     /* s k a: unless the head of form k is bound to special
+                                          form s, evaluate the form and continue at a */
+  OP_PRIM,                      /* p:   binary primitive p if the function below the
+                                        operands is bound to it, otherwise call it */
+  OP_JUMP,                      /* a:   continue at a */
+  OP_JUMP_NIL,                  /* a:   pop, continue at a if nil */
+  OP_AND,                       /* a:   continue at a if nil, otherwise pop */
+  OP_OR,                        /* a:   continue at a if not nil, otherwise pop */
+  OP_RETURN,
+} lop;
+
+static lbuiltin *lprim_builtins[] = {
+  builtin_add, builtin_sub, builtin_mul, builtin_div,
+  builtin_gt, builtin_lt, builtin_ge, builtin_le, builtin_eq
+};
+
+#define NR_OF_PRIMS (sizeof(lprim_builtins) / sizeof(lbuiltin*))
+
+static lbuiltin *lspecial_builtins[] = {
+  builtin_lambda, builtin_quote, builtin_if, builtin_and, builtin_or
+};
+
+#define NR_OF_SPECIALS (sizeof(lspecial_builtins) / sizeof(lbuiltin*))
+
+typedef struct lcode {
+  int   *ops;
+  long   length;
+  long   capacity;
+  tlist *consts;
+  tlist *closures;              /* code of the lambdas in the body */
+  lval  *names;                 /* parameters in slot order */
+  tlist *scopes;                /* names of the enclosing lambdas, innermost first */
+  long   restpos;
+  int    has_rest;
+  long   depth;
+  long   max_depth;
+  long   refs;
+} lcode;
+
+/*
+ * Captured variables, the locals of a frame that created a closure.
+ */
+typedef struct lvars {
+  long   refs;
+  lvars *parent;
+  long   size;
+  lval  *slots[];
+} lvars;
+
+void
+lvars_free (lvars *vars)
+{
+  while (vars && --vars->refs == 0) {
+    lvars *parent = vars->parent;
+    for (long i = 0; i < vars->size; i++) {
+      lval_free(vars->slots[i]);
+    }
+    free(vars);
+    vars = parent;
+  }
+}
+
+void
+lcode_free (lcode *code)
+{
+  if (--code->refs > 0) {
+    return;
+  }
+  for (long i = 0; i < list_length(code->consts); i++) {
+    lval_free(list_nth(code->consts, i));
+  }
+  for (long i = 0; i < list_length(code->closures); i++) {
+    lcode_free(list_nth(code->closures, i));
+  }
+  for (long i = 0; i < list_length(code->scopes); i++) {
+    lval_free(list_nth(code->scopes, i));
+  }
+  list_free(code->consts);
+  list_free(code->closures);
+  list_free(code->scopes);
+  lval_free(code->names);
+  free(code->ops);
+  free(code);
+}
+
+long
+lcode_emit (lcode *code, int op)
+{
+  if (code->length == code->capacity) {
+    code->capacity = code->capacity ? 2 * code->capacity : 32;
+    code->ops = realloc(code->ops, code->capacity * sizeof(int));
+  }
+  code->ops[code->length] = op;
+  return code->length++;
+}
+
+/*
+ * Account for instructions changing the depth of the stack by DELTA.
+ */
+void
+lcode_stack (lcode *code, long delta)
+{
+  code->depth += delta;
+  code->max_depth = max(code->max_depth, code->depth);
+}
+
+/*
+ * Add constant, consumes VAL.
+ */
+int
+lcode_const (lcode *code, lval *val)
+{
+  list_append(code->consts, val);
+  return list_length(code->consts) - 1;
+}
+
+long
+lcode_slot (const lval *names, const lval *sym)
+{
+  for (long i = lval_lst_length(names) - 1; i >= 0; i--) {
+    if (lval_lst_nth(names, i)->value == sym->value) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Resolve SYM to a slot of the locals, DEPTH 0, or of the captured
+ * variables at DEPTH. Returns -1 if SYM is not a parameter.
+ */
+long
+lcode_resolve (const lcode *code, const lval *sym, long *depth)
+{
+  long slot = lcode_slot(code->names, sym);
+  *depth = 0;
+  while (slot < 0 && *depth < list_length(code->scopes)) {
+    slot = lcode_slot(list_nth(code->scopes, (*depth)++), sym);
+  }
+  return slot;
+}
+
+lcode *lcode_compile_scoped (lenv *env, lval *args, lval *body, tlist *scopes);
+
+int lcode_compile_expr (lcode *code, lenv *env, lval *expr, int tail);
+
+/*
+ * Compile a call of a function that may turn out to be a special form,
+ * which is then given the arguments unevaluated. If PRIM is not -1 the
+ * call is to binary primitive PRIM, unless the head is rebound.
+ */
+int
+lcode_compile_call (lcode *code, lenv *env, lval *form, long prim, int tail)
+{
+  long argc = lval_lst_length(form) - 1;
+  if (!lcode_compile_expr(code, env, lval_lst_nth(form, 0), 0)) {
+    return 0;
+  }
+  lcode_emit(code, OP_SPECIAL);
+  lcode_emit(code, lcode_const(code, lval_ref(form)));
+  long special = lcode_emit(code, 0);
+  for (long i = 1; i <= argc; i++) {
+    if (!lcode_compile_expr(code, env, lval_lst_nth(form, i), 0)) {
+      return 0;
+    }
+  }
+  if (prim >= 0) {
+    lcode_emit(code, OP_PRIM);
+    lcode_emit(code, prim);
+  } else {
+    lcode_emit(code, tail ? OP_TAILCALL : OP_CALL);
+    lcode_emit(code, argc);
+  }
+  lcode_stack(code, -argc);
+  code->ops[special] = code->length;
+  if (tail) {
+    lcode_emit(code, OP_RETURN);
+  }
+  return 1;
+}
+
+/*
+ * Compile if, and, or, and quote. Returns 0 for any other special form.
+ */
+int
+lcode_compile_special (lcode *code, lenv *env, lval *form, lbuiltin *builtin, int tail)
+{
+  long argc = lval_lst_length(form) - 1;
+
+  if (builtin == builtin_lambda && argc == 2 && lval_lst_nth(form, 1)->type == LVAL_LST) {
+    tlist *scopes = list_sized(list_length(code->scopes) + 1);
+    list_append(scopes, lval_ref(code->names));
+    for (long i = 0; i < list_length(code->scopes); i++) {
+      list_append(scopes, lval_ref(list_nth(code->scopes, i)));
+    }
+    lcode *inner = lcode_compile_scoped(env, lval_lst_nth(form, 1), lval_lst_nth(form, 2), scopes);
+    if (inner == NULL) {
+      return 0;
+    }
+    list_append(code->closures, inner);
+    lcode_emit(code, OP_CLOSURE);
+    lcode_emit(code, list_length(code->closures) - 1);
+    lcode_emit(code, lcode_const(code, lval_ref(form)));
+    lcode_stack(code, 1);
+    if (tail) {
+      lcode_emit(code, OP_RETURN);
+    }
+    return 1;
+  }
+
+  if (builtin == builtin_quote && argc == 1) {
+    lval *val = lval_unshare(lval_ref(lval_lst_nth(form, 1)));
+    lval_quote(val);
+    lcode_emit(code, OP_CONST);
+    lcode_emit(code, lcode_const(code, val));
+    lcode_stack(code, 1);
+    if (tail) {
+      lcode_emit(code, OP_RETURN);
+    }
+    return 1;
+  }
+
+  if (builtin == builtin_if && argc == 3) {
+    if (!lcode_compile_expr(code, env, lval_lst_nth(form, 1), 0)) {
+      return 0;
+    }
+    lcode_emit(code, OP_JUMP_NIL);
+    long alternative = lcode_emit(code, 0);
+    lcode_stack(code, -1);
+    if (!lcode_compile_expr(code, env, lval_lst_nth(form, 2), tail)) {
+      return 0;
+    }
+    long end = -1;
+    if (!tail) {
+      lcode_emit(code, OP_JUMP);
+      end = lcode_emit(code, 0);
+    }
+    lcode_stack(code, -1);
+    code->ops[alternative] = code->length;
+    if (!lcode_compile_expr(code, env, lval_lst_nth(form, 3), tail)) {
+      return 0;
+    }
+    if (!tail) {
+      code->ops[end] = code->length;
+    }
+    return 1;
+  }
+
+  if ((builtin == builtin_and || builtin == builtin_or) && argc >= 1) {
+    tlist *jumps = list();
+    for (long i = 1; i < argc; i++) {
+      if (!lcode_compile_expr(code, env, lval_lst_nth(form, i), 0)) {
+        list_free(jumps);
+        return 0;
+      }
+      lcode_emit(code, builtin == builtin_and ? OP_AND : OP_OR);
+      list_append(jumps, (void*)lcode_emit(code, 0));
+      lcode_stack(code, -1);
+    }
+    if (!lcode_compile_expr(code, env, lval_lst_nth(form, argc), tail)) {
+      list_free(jumps);
+      return 0;
+    }
+    // In tail position the jumps return the value they tested.
+    for (long i = 0; i < list_length(jumps); i++) {
+      code->ops[(long)list_nth(jumps, i)] = code->length;
+    }
+    list_free(jumps);
+    if (tail) {
+      lcode_emit(code, OP_RETURN);
+    }
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Compile special form FORM inline, guarded on its head still being
+ * bound to BUILTIN when it runs. Otherwise the tree-walker evaluates
+ * the form with whatever the head is bound to then.
+ */
+int
+lcode_compile_bound (lcode *code, lenv *env, lval *form, lbuiltin *builtin, int tail)
+{
+  long s = 0;
+  while (s < NR_OF_SPECIALS && lspecial_builtins[s] != builtin) {
+    s++;
+  }
+  if (s == NR_OF_SPECIALS) {
+    return 0;
+  }
+  lcode_emit(code, OP_BOUND);
+  lcode_emit(code, s);
+  lcode_emit(code, lcode_const(code, lval_ref(form)));
+  long end = lcode_emit(code, 0);
+  if (!lcode_compile_special(code, env, form, builtin, tail)) {
+    return 0;
+  }
+  code->ops[end] = code->length;
+  if (tail) {
+    lcode_emit(code, OP_RETURN);
+  }
+  return 1;
+}
+
+int
+lcode_compile_form (lcode *code, lenv *env, lval *form, int tail)
+{
+  lval *head = lval_lst_nth(form, 0);
+  long argc = lval_lst_length(form) - 1;
+  long depth;
+
+  if (head->type == LVAL_SYM && lcode_resolve(code, head, &depth) < 0) {
+    lval *fun = lenv_get_key(env, head->value);
+    lfun *f = (fun && fun->type == LVAL_FUN) ? fun->value : NULL;
+    if (f && f->builtin) {
+      if (f->is_special) {
+        return lcode_compile_bound(code, env, form, f->builtin, tail);
+      }
+      if (f->builtin == builtin_eval || f->builtin == builtin_load) {
+        return 0;
+      }
+      for (long p = 0; p < NR_OF_PRIMS && argc == 2; p++) {
+        if (f->builtin == lprim_builtins[p]) {
+          return lcode_compile_call(code, env, form, p, tail);
+        }
+      }
+    }
+  }
+
+  return lcode_compile_call(code, env, form, -1, tail);
+}
+
+int
+lcode_compile_expr (lcode *code, lenv *env, lval *expr, int tail)
+{
+  if (expr->type == LVAL_SYM) {
+    long depth;
+    long slot = lcode_resolve(code, expr, &depth);
+    if (slot >= 0 && depth == 0) {
+      lcode_emit(code, OP_LOCAL);
+      lcode_emit(code, slot);
+    } else if (slot >= 0) {
+      lcode_emit(code, OP_OUTER);
+      lcode_emit(code, depth);
+      lcode_emit(code, slot);
+    } else {
+      lcode_emit(code, OP_GLOBAL);
+      lcode_emit(code, lcode_const(code, lval_ref(expr)));
+    }
+    lcode_stack(code, 1);
+  } else if (expr->type == LVAL_LST && lval_lst_length(expr) && !lval_is_quoted(expr)) {
+    return lcode_compile_form(code, env, expr, tail);
+  } else {
+    lcode_emit(code, OP_CONST);
+    lcode_emit(code, lcode_const(code, lval_ref(expr)));
+    lcode_stack(code, 1);
+  }
+
+  if (tail) {
+    lcode_emit(code, OP_RETURN);
+  }
+  return 1;
+}
+
+/*
+ * Compile the body of a lambda defined in ENV, nested in lambdas with
+ * parameter names SCOPES. Consumes SCOPES. Returns NULL if the body
+ * cannot be compiled.
+ */
+lcode *
+lcode_compile_scoped (lenv *env, lval *args, lval *body, tlist *scopes)
+{
+  static const char *rest_key = NULL;
+  if (rest_key == NULL) {
+    rest_key = string_intern("&rest");
+  }
+
+  lcode *code = malloc(sizeof(lcode));
+  code->ops = NULL;
+  code->length = 0;
+  code->capacity = 0;
+  code->consts = list();
+  code->closures = list();
+  code->names = lval_lst();
+  code->scopes = scopes;
+  code->restpos = lval_lst_length(args);
+  code->has_rest = 0;
+  code->depth = 0;
+  code->max_depth = 0;
+  code->refs = 1;
+
+  for (long i = 0; i < lval_lst_length(args); i++) {
+    lval *sym = lval_lst_nth(args, i);
+    if (sym->type != LVAL_SYM) {
+      lcode_free(code);
+      return NULL;
+    }
+    if (sym->value == rest_key && code->restpos == lval_lst_length(args)) {
+      code->restpos = i;
+    } else {
+      lval_lst_append(code->names, lval_ref(sym));
+    }
+  }
+  if (code->restpos < lval_lst_length(args)) {
+    if (code->restpos + 2 != lval_lst_length(args)) {
+      lcode_free(code);
+      return NULL;
+    }
+    code->has_rest = 1;
+  }
+
+  int ok;
+  if (body->type == LVAL_LST && lval_lst_length(body)) {
+    ok = lcode_compile_form(code, env, body, 1);
   } else {
-    char *errmsg = lparser_error(p);
-    expr = lval_err("Error loading library %s", errmsg);
-    free(errmsg);
+    ok = lcode_compile_expr(code, env, body, 1);
+  }
+  if (!ok) {
+    lcode_free(code);
+    return NULL;
+  }
+  return code;
+}
+
+lcode *
+lcode_compile (lenv *env, lval *args, lval *body)
+{
+  return lcode_compile_scoped(env, args, body, list());
+}
+
+
+
+/*
+ * The machine keeps one value stack and one frame stack. Calls between
+ * compiled functions push a frame instead of recursing in C. Values on
+ * the stack are addressed by index because nested runs, entered through
+ * builtins, may reallocate it.
+ */
+typedef struct lframe {
+  lfun  *fun;
+  long   pc;
+  long   base;                  /* stack index of the first local */
+  lenv  *env;                   /* environment of the locals, created on demand */
+  lvars *vars;                  /* locals captured by closures, created on demand */
+} lframe;
+
+static lval   **lvm_stack = NULL;
+static long     lvm_sp = 0;
+static long     lvm_stack_capacity = 0;
+static lframe  *lvm_frames = NULL;
+static long     lvm_fp = 0;
+static long     lvm_frames_capacity = 0;
+
+void
+lvm_reserve (long size)
+{
+  if (lvm_sp + size > lvm_stack_capacity) {
+    lvm_stack_capacity = max(lvm_sp + size, 2 * lvm_stack_capacity);
+    lvm_stack = realloc(lvm_stack, lvm_stack_capacity * sizeof(lval*));
   }
+}
+
+void
+lvm_push (lval *val)
+{
+  lvm_reserve(1);
+  lvm_stack[lvm_sp++] = val;
+}
 
-  lparser_delete(p);
-  return expr;
+/*
+ * Release the stack down to index SP.
+ */
+void
+lvm_pop_to (long sp)
+{
+  while (lvm_sp > sp) {
+    lval *val = lvm_stack[--lvm_sp];
+    if (val) {
+      lval_free(val);
+    }
+  }
+}
+
+/*
+ * Return an environment binding the locals of FRAME by name, for
+ * special forms and builtins that evaluate in the caller's
+ * environment.
+ */
+lenv *
+lframe_env (lframe *frame)
+{
+  if (frame->env == NULL) {
+    lfun  *f = frame->fun;
+    lcode *code = f->code;
+    frame->env = lenv_create(f->env);
+    for (long depth = list_length(code->scopes); depth > 0; depth--) {
+      lvars *vars = f->vars;
+      for (long d = 1; d < depth; d++) {
+        vars = vars->parent;
+      }
+      lval *names = list_nth(code->scopes, depth - 1);
+      for (long i = 0; i < vars->size; i++) {
+        lenv_put_sym(frame->env, lval_lst_nth(names, i), vars->slots[i]);
+      }
+    }
+    for (long i = 0; i < lval_lst_length(code->names); i++) {
+      lenv_put_sym(frame->env, lval_lst_nth(code->names, i), lvm_stack[frame->base + i]);
+    }
+  }
+  return frame->env;
+}
+
+/*
+ * Return the locals of FRAME as captured variables.
+ */
+lvars *
+lframe_vars (lframe *frame)
+{
+  if (frame->vars == NULL) {
+    long size = lval_lst_length(frame->fun->code->names);
+    lvars *vars = malloc(sizeof(lvars) + size * sizeof(lval*));
+    vars->refs = 1;
+    vars->parent = frame->fun->vars;
+    if (vars->parent) {
+      vars->parent->refs++;
+    }
+    vars->size = size;
+    for (long i = 0; i < size; i++) {
+      vars->slots[i] = lval_ref(lvm_stack[frame->base + i]);
+    }
+    frame->vars = vars;
+  }
+  return frame->vars;
+}
+
+/*
+ * Release the environment and captured variables of FRAME.
+ */
+void
+lframe_release (lframe *frame)
+{
+  if (frame->env) {
+    lenv_free(frame->env);
+  }
+  if (frame->vars) {
+    lvars_free(frame->vars);
+  }
+}
+
+/*
+ * Enter compiled function F with ARGC arguments on top of the stack.
+ * Returns NULL on success, an error otherwise.
+ */
+lval *
+lvm_enter (lfun *f, long argc)
+{
+  lcode *code = f->code;
+  long base = lvm_sp - argc;
+
+  if (argc < code->restpos) {
+    return lval_err("Invalid number of arguments: >= %d, %d", code->restpos, argc);
+  }
+  if (code->has_rest) {
+    lval *rest = lval_lst_sized(argc - code->restpos);
+    for (long i = base + code->restpos; i < lvm_sp; i++) {
+      lval_lst_append(rest, lvm_stack[i]);
+    }
+    lvm_sp = base + code->restpos;
+    lvm_push(rest);
+  } else {
+    lvm_pop_to(base + code->restpos);
+  }
+  lvm_reserve(code->max_depth + 1);
+
+  if (lvm_fp == lvm_frames_capacity) {
+    lvm_frames_capacity = lvm_frames_capacity ? 2 * lvm_frames_capacity : 64;
+    lvm_frames = realloc(lvm_frames, lvm_frames_capacity * sizeof(lframe));
+  }
+  lframe *frame = &lvm_frames[lvm_fp++];
+  frame->fun = f;
+  frame->pc = 0;
+  frame->base = base;
+  frame->env = NULL;
+  frame->vars = NULL;
+  return NULL;
+}
+
+/*
+ * Leave the current frame, releasing its locals and the function
+ * below them.
+ */
+void
+lvm_leave ()
+{
+  lframe *frame = &lvm_frames[--lvm_fp];
+  lframe_release(frame);
+  lvm_pop_to(frame->base - 1);
+}
+
+/*
+ * Call the function at stack index SP - ARGC - 1 with the ARGC values
+ * above it, unless it is a compiled function. Returns the result, or
+ * NULL if a frame for a compiled function was entered.
+ */
+lval *
+lvm_call (lframe *frame, long argc)
+{
+  long callee = lvm_sp - argc - 1;
+  lval *fun = lvm_stack[callee];
+  lval *ret = NULL;
+
+  if (fun->type != LVAL_FUN) {
+    ret = lval_err("Invalid function");
+  }
+  for (long i = callee + 1; ret == NULL && i < lvm_sp; i++) {
+    if (lvm_stack[i]->type == LVAL_ERR) {
+      ret = lval_ref(lvm_stack[i]);
+    }
+  }
+  if (ret) {
+    lvm_pop_to(callee);
+    return ret;
+  }
+
+  lfun *f = fun->value;
+  if (f->code) {
+    ret = lvm_enter(f, argc);
+    if (ret) {
+      lvm_pop_to(callee);
+    }
+    return ret;
+  }
+
+  lval *arg = lval_lst_sized(argc);
+  for (long i = callee + 1; i < lvm_sp; i++) {
+    lval_lst_append(arg, lvm_stack[i]);
+  }
+  lvm_sp = callee + 1;
+
+  if (f->builtin == builtin_eval || f->builtin == builtin_load) {
+    ret = lval_fun_call(lframe_env(frame), fun, arg);
+  } else {
+    ret = lval_fun_call(frame->fun->env, fun, arg);
+  }
+  lval_free(arg);
+  lvm_pop_to(callee);
+  return ret;
+}
+
+lval *
+lval_bool (int cond)
+{
+  if (cond) {
+    return LVAL_T();
+  }
+  return LVAL_NIL();
+}
+
+/*
+ * Apply primitive P to the two numbers on top of the stack. Returns
+ * NULL if an operand is not a number.
+ */
+lval *
+lvm_prim (lprim p)
+{
+  lval *a = lvm_stack[lvm_sp - 2];
+  lval *b = lvm_stack[lvm_sp - 1];
+  if (!LVAL_IS_NUMBER(a) || !LVAL_IS_NUMBER(b)) {
+    return NULL;
+  }
+  lnum x = lnum_of(a);
+  lnum y = lnum_of(b);
+  lval *ret = NULL;
+  switch (p) {
+  case PRIM_ADD:
+  case PRIM_SUB:
+  case PRIM_MUL:
+  case PRIM_DIV:
+    if (!lnum_arith(p, &x, y)) {
+      return NULL;
+    }
+    ret = lnum_lval(x);
+    break;
+  case PRIM_GT: ret = lval_bool(lnum_compare(x, y) > 0); break;
+  case PRIM_LT: ret = lval_bool(lnum_compare(x, y) < 0); break;
+  case PRIM_GE: ret = lval_bool(lnum_compare(x, y) >= 0); break;
+  case PRIM_LE: ret = lval_bool(lnum_compare(x, y) <= 0); break;
+  case PRIM_EQ: ret = lval_bool(lnum_compare(x, y) == 0); break;
+  }
+  lvm_pop_to(lvm_sp - 2);
+  return ret;
+}
+
+/*
+ * Run frames until the frame at index FP returns.
+ */
+lval *
+lvm_run (long fp)
+{
+  while (1) {
+    lframe *frame = &lvm_frames[lvm_fp - 1];
+    lcode  *code = frame->fun->code;
+    int    *ops = code->ops;
+    lval   *val = NULL;
+
+    switch (ops[frame->pc++]) {
+    case OP_CONST:
+      lvm_push(lval_ref(list_nth(code->consts, ops[frame->pc++])));
+      break;
+
+    case OP_LOCAL:
+      lvm_push(lval_ref(lvm_stack[frame->base + ops[frame->pc++]]));
+      break;
+
+    case OP_OUTER: {
+      lvars *vars = frame->fun->vars;
+      for (long d = ops[frame->pc++]; d > 1; d--) {
+        vars = vars->parent;
+      }
+      lvm_push(lval_ref(vars->slots[ops[frame->pc++]]));
+      break;
+    }
+
+    case OP_CLOSURE: {
+      lcode *inner = list_nth(code->closures, ops[frame->pc++]);
+      lval  *form = list_nth(code->consts, ops[frame->pc++]);
+      lvars *vars = lframe_vars(frame);
+      inner->refs++;
+      vars->refs++;
+      lvm_push(lval_fun_closure(frame->fun->env, lval_lst_nth(form, 1), lval_lst_nth(form, 2), inner, vars));
+      break;
+    }
+
+    case OP_GLOBAL: {
+      lval *sym = list_nth(code->consts, ops[frame->pc++]);
+      lval *ref = lenv_get_key(frame->fun->env, sym->value);
+      lvm_push(ref ? lval_ref(ref) : lval_err("Void variable: %s", (char*)sym->value));
+      break;
+    }
+
+    case OP_SPECIAL: {
+      lval *form = list_nth(code->consts, ops[frame->pc++]);
+      long target = ops[frame->pc++];
+      lval *fun = lvm_stack[lvm_sp - 1];
+      if (fun->type != LVAL_FUN || !((lfun*)fun->value)->is_special) {
+        break;
+      }
+      // Evaluating the form may grow the frames, leave this one first.
+      frame->pc = target;
+      lenv *env = lframe_env(frame);
+      lval *call = lval_lst_insert(lval_lst_drop(form, 1), lvm_stack[--lvm_sp]);
+      lvm_push(lval_eval_unquoted(env, call));
+      break;
+    }
+
+    case OP_BOUND: {
+      lbuiltin *builtin = lspecial_builtins[ops[frame->pc++]];
+      lval *form = list_nth(code->consts, ops[frame->pc++]);
+      long target = ops[frame->pc++];
+      lval *sym = lval_lst_nth(form, 0);
+      lval *fun = lenv_get_key(frame->fun->env, sym->value);
+      if (fun && fun->type == LVAL_FUN && ((lfun*)fun->value)->builtin == builtin) {
+        break;
+      }
+      frame->pc = target;
+      lvm_push(lval_eval_unquoted(lframe_env(frame), lval_ref(form)));
+      break;
+    }
+
+    case OP_PRIM: {
+      lprim p = ops[frame->pc++];
+      lval *fun = lvm_stack[lvm_sp - 3];
+      if (fun->type == LVAL_FUN && ((lfun*)fun->value)->builtin == lprim_builtins[p]) {
+        val = lvm_prim(p);
+      }
+      if (val) {
+        lval_free(fun);
+        lvm_stack[lvm_sp - 1] = val;
+        val = NULL;
+        break;
+      }
+      // Not a primitive application, call it instead.
+      lval *ret = lvm_call(frame, 2);
+      if (ret) {
+        lvm_push(ret);
+      }
+      break;
+    }
+
+    case OP_CALL: {
+      long argc = ops[frame->pc++];
+      lval *ret = lvm_call(frame, argc);
+      if (ret) {
+        lvm_push(ret);
+      }
+      break;
+    }
+
+    case OP_TAILCALL: {
+      long argc = ops[frame->pc++];
+      long callee = lvm_sp - argc - 1;
+      lval *fun = lvm_stack[callee];
+      int compiled = fun->type == LVAL_FUN && ((lfun*)fun->value)->code;
+      for (long i = callee + 1; compiled && i < lvm_sp; i++) {
+        compiled = lvm_stack[i]->type != LVAL_ERR;
+      }
+      if (!compiled) {
+        val = lvm_call(frame, argc);
+        break;
+      }
+
+      // Replace the current frame: release its locals and move the
+      // function and its arguments down in their place.
+      long dst = frame->base - 1;
+      lframe_release(frame);
+      for (long i = dst; i < callee; i++) {
+        if (lvm_stack[i]) {
+          lval_free(lvm_stack[i]);
+        }
+      }
+      memmove(&lvm_stack[dst], &lvm_stack[callee], (argc + 1) * sizeof(lval*));
+      lvm_sp = dst + argc + 1;
+      lvm_fp--;
+
+      lval *err = lvm_enter(fun->value, argc);
+      if (err) {
+        lvm_pop_to(dst);
+        if (lvm_fp == fp) {
+          return err;
+        }
+        lvm_push(err);
+      }
+      break;
+    }
+
+    case OP_JUMP:
+      frame->pc = ops[frame->pc];
+      break;
+
+    case OP_JUMP_NIL: {
+      long target = ops[frame->pc++];
+      lval *cond = lvm_stack[--lvm_sp];
+      if (cond->type == LVAL_ERR) {
+        val = cond;
+        break;
+      }
+      if (LVAL_IS_NIL(cond)) {
+        frame->pc = target;
+      }
+      lval_free(cond);
+      break;
+    }
+
+    case OP_AND:
+    case OP_OR: {
+      int  op = ops[frame->pc - 1];
+      long target = ops[frame->pc++];
+      lval *top = lvm_stack[lvm_sp - 1];
+      if (top->type == LVAL_ERR) {
+        val = lvm_stack[--lvm_sp];
+        break;
+      }
+      if (LVAL_IS_NIL(top) == (op == OP_AND)) {
+        frame->pc = target;
+      } else {
+        lval_free(lvm_stack[--lvm_sp]);
+      }
+      break;
+    }
+
+    case OP_RETURN:
+      val = lvm_stack[--lvm_sp];
+      break;
+    }
+
+    if (val) {
+      lvm_leave();
+      if (lvm_fp == fp) {
+        return val;
+      }
+      lvm_push(val);
+    }
+  }
+}
+
+/*
+ * Call compiled function F with the arguments in list ARG.
+ */
+lval *
+lcode_call (lfun *f, lval *arg)
+{
+  long fp = lvm_fp;
+  long sp = lvm_sp;
+
+  lvm_push(NULL);
+  for (long i = 0; i < lval_lst_length(arg); i++) {
+    lvm_push(lval_ref(lval_lst_nth(arg, i)));
+  }
+  lval *err = lvm_enter(f, lval_lst_length(arg));
+  if (err) {
+    lvm_pop_to(sp);
+    return err;
+  }
+  return lvm_run(fp);
+}
+
+
+
+/*
+ * Cycle collector.
+ *
+ * Values are reference counted and freed as soon as the last reference
+ * is dropped. Cycles can only be created by binding a value in an
+ * environment it references, e.g. a function defined in the environment
+ * it captures, or by storing a value in a vector it references, so the
+ * collector traces everything reachable from the live environments and
+ * vectors. An object with more references than it has from within the
+ * traced heap is held by the REPL, the evaluator stack or a builtin, and
+ * is a root. Environments and vectors not reachable from a root are
+ * garbage; clearing them breaks the cycles and the reference counts free
+ * the rest.
+ */
+
+long lgc_threshold = 1024;
+long lgc_growth = 100;
+
+static long    lgc_created = 0;
+static long    lgc_heap_size = 0;
+static long    lgc_collections = 0;
+static long    lgc_freed = 0;
+static clock_t lgc_pause_total = 0;
+static clock_t lgc_pause_max = 0;
+
+typedef enum lgc_kind { GC_LVAL, GC_LSTORE, GC_LFUN, GC_LENV, GC_LVARS, GC_LCODE, GC_LVEC } lgc_kind;
+
+typedef struct lgc_node {
+  void     *ptr;
+  lgc_kind  kind;
+  long      internal;           /* references from within the heap */
+  int       live;
+} lgc_node;
+
+typedef struct lgc_heap {
+  lgc_node *nodes;              /* open addressing by pointer */
+  long      size;
+  long      capacity;
+  tlist    *work;
+} lgc_heap;
+
+typedef void lgc_visit (lgc_heap *heap, void *ptr, lgc_kind kind);
+
+lgc_node *
+lgc_slot (lgc_heap *heap, const void *ptr)
+{
+  long pos = ((uintptr_t)ptr >> 4) * 2654435761u & (heap->capacity - 1);
+  while (heap->nodes[pos].ptr && heap->nodes[pos].ptr != ptr) {
+    pos = (pos + 1) & (heap->capacity - 1);
+  }
+  return &heap->nodes[pos];
+}
+
+/*
+ * Return node of PTR, adding it to the heap and the work list if new.
+ */
+lgc_node *
+lgc_node_get (lgc_heap *heap, void *ptr, lgc_kind kind)
+{
+  if (2 * (heap->size + 1) > heap->capacity) {
+    lgc_node *nodes = heap->nodes;
+    long capacity = heap->capacity;
+    heap->capacity = capacity ? 2 * capacity : 256;
+    heap->nodes = calloc(heap->capacity, sizeof(lgc_node));
+    for (long i = 0; i < capacity; i++) {
+      if (nodes[i].ptr) {
+        *lgc_slot(heap, nodes[i].ptr) = nodes[i];
+      }
+    }
+    free(nodes);
+  }
+
+  lgc_node *node = lgc_slot(heap, ptr);
+  if (node->ptr == NULL) {
+    node->ptr = ptr;
+    node->kind = kind;
+    node->internal = 0;
+    node->live = 0;
+    heap->size++;
+    list_append(heap->work, ptr);
+  }
+  return node;
+}
+
+long
+lgc_refs (const lgc_node *node)
+{
+  switch (node->kind) {
+  case GC_LVAL: return ((lval*)node->ptr)->refs;
+  case GC_LSTORE: return ((lstore*)node->ptr)->refs;
+  case GC_LFUN: return ((lfun*)node->ptr)->refs;
+  case GC_LENV: return ((lenv*)node->ptr)->refs;
+  case GC_LVARS: return ((lvars*)node->ptr)->refs;
+  case GC_LCODE: return ((lcode*)node->ptr)->refs;
+  case GC_LVEC: return ((lvector*)node->ptr)->refs;
+  }
+  return 0;
+}
+
+/*
+ * Return true if PTR cannot reference other objects.
+ */
+int
+lgc_is_leaf (const void *ptr, lgc_kind kind)
+{
+  if (ptr == NULL) {
+    return 1;
+  }
+  if (kind == GC_LVAL) {
+    ltype type = ((lval*)ptr)->type;
+    return type != LVAL_LST && type != LVAL_FUN && type != LVAL_TAIL && type != LVAL_VEC;
+  }
+  if (kind == GC_LFUN) {
+    return ((lfun*)ptr)->builtin != NULL;
+  }
+  return 0;
+}
+
+/*
+ * Call VISIT for every object referenced by PTR.
+ */
+void
+lgc_traverse (lgc_heap *heap, void *ptr, lgc_kind kind, lgc_visit *visit)
+{
+  switch (kind) {
+  case GC_LVAL: {
+    lval *val = ptr;
+    if (val->type == LVAL_LST) {
+      visit(heap, ((llist*)val->value)->store, GC_LSTORE);
+    } else if (val->type == LVAL_FUN) {
+      visit(heap, val->value, GC_LFUN);
+    } else if (val->type == LVAL_TAIL) {
+      visit(heap, val->value, GC_LVAL);
+    } else if (val->type == LVAL_VEC) {
+      visit(heap, val->value, GC_LVEC);
+    }
+    break;
+  }
+  case GC_LSTORE: {
+    lstore *store = ptr;
+    for (long i = store->low; i < store->high; i++) {
+      visit(heap, store->slots[i], GC_LVAL);
+    }
+    break;
+  }
+  case GC_LFUN: {
+    lfun *f = ptr;
+    visit(heap, f->body, GC_LVAL);
+    visit(heap, f->args, GC_LVAL);
+    visit(heap, f->code, GC_LCODE);
+    visit(heap, f->vars, GC_LVARS);
+    visit(heap, f->env, GC_LENV);
+    break;
+  }
+  case GC_LENV: {
+    lenv *env = ptr;
+    for (long i = 0; i < env->capacity; i++) {
+      if (env->names[i]) {
+        visit(heap, env->lvals[i], GC_LVAL);
+      }
+    }
+    visit(heap, env->parent, GC_LENV);
+    break;
+  }
+  case GC_LVARS: {
+    lvars *vars = ptr;
+    for (long i = 0; i < vars->size; i++) {
+      visit(heap, vars->slots[i], GC_LVAL);
+    }
+    visit(heap, vars->parent, GC_LVARS);
+    break;
+  }
+  case GC_LCODE: {
+    lcode *code = ptr;
+    for (long i = 0; i < list_length(code->consts); i++) {
+      visit(heap, list_nth(code->consts, i), GC_LVAL);
+    }
+    for (long i = 0; i < list_length(code->closures); i++) {
+      visit(heap, list_nth(code->closures, i), GC_LCODE);
+    }
+    for (long i = 0; i < list_length(code->scopes); i++) {
+      visit(heap, list_nth(code->scopes, i), GC_LVAL);
+    }
+    visit(heap, code->names, GC_LVAL);
+    break;
+  }
+  case GC_LVEC: {
+    lvector *vec = ptr;
+    for (long i = 0; i < list_length(vec->members); i++) {
+      visit(heap, list_nth(vec->members, i), GC_LVAL);
+    }
+    break;
+  }
+  }
+}
+
+void
+lgc_scan (lgc_heap *heap, void *ptr, lgc_kind kind)
+{
+  if (!lgc_is_leaf(ptr, kind)) {
+    lgc_node_get(heap, ptr, kind)->internal++;
+  }
+}
+
+void
+lgc_mark (lgc_heap *heap, void *ptr, lgc_kind kind)
+{
+  if (!lgc_is_leaf(ptr, kind)) {
+    lgc_node *node = lgc_slot(heap, ptr);
+    if (!node->live) {
+      node->live = 1;
+      list_append(heap->work, ptr);
+    }
+  }
+}
+
+/*
+ * Drop all bindings and the parent of ENV.
+ */
+void
+lenv_clear (lenv *env)
+{
+  for (long i = 0; i < env->capacity; i++) {
+    if (env->names[i]) {
+      lval_free(env->lvals[i]);
+    }
+  }
+  mem_free(env->names, env->capacity * sizeof(char*));
+  mem_free(env->lvals, env->capacity * sizeof(lval*));
+  env->names = NULL;
+  env->lvals = NULL;
+  env->size = 0;
+  env->capacity = 0;
+  if (env->parent) {
+    lenv_free(env->parent);
+    env->parent = NULL;
+  }
+}
+
+/*
+ * Free unreachable cycles, returns the number of objects freed.
+ */
+long
+lgc_collect ()
+{
+  clock_t start = clock();
+  lgc_heap heap = { NULL, 0, 0, list() };
+
+  for (lenv *env = lenv_all; env; env = env->gc_next) {
+    lgc_node_get(&heap, env, GC_LENV);
+  }
+  for (lvector *vec = lvector_all; vec; vec = vec->gc_next) {
+    lgc_node_get(&heap, vec, GC_LVEC);
+  }
+  while (list_length(heap.work)) {
+    void *ptr = list_take(heap.work, list_length(heap.work) - 1);
+    lgc_traverse(&heap, ptr, lgc_slot(&heap, ptr)->kind, lgc_scan);
+  }
+
+  for (long i = 0; i < heap.capacity; i++) {
+    lgc_node *node = &heap.nodes[i];
+    if (node->ptr && !node->live && lgc_refs(node) > node->internal) {
+      node->live = 1;
+      list_append(heap.work, node->ptr);
+    }
+  }
+  while (list_length(heap.work)) {
+    void *ptr = list_take(heap.work, list_length(heap.work) - 1);
+    lgc_traverse(&heap, ptr, lgc_slot(&heap, ptr)->kind, lgc_mark);
+  }
+
+  long freed = 0;
+  tlist *garbage = list();
+  tlist *vectors = list();
+  for (long i = 0; i < heap.capacity; i++) {
+    lgc_node *node = &heap.nodes[i];
+    if (node->ptr && !node->live) {
+      freed++;
+      if (node->kind == GC_LENV) {
+        list_append(garbage, lenv_ref(node->ptr));
+      } else if (node->kind == GC_LVEC) {
+        list_append(vectors, lvector_ref(node->ptr));
+      }
+    }
+  }
+  lgc_heap_size = heap.size - freed;
+  free(heap.nodes);
+  list_free(heap.work);
+
+  for (long i = 0; i < list_length(garbage); i++) {
+    lenv_clear(list_nth(garbage, i));
+  }
+  for (long i = 0; i < list_length(vectors); i++) {
+    lvector_clear(list_nth(vectors, i));
+  }
+  for (long i = 0; i < list_length(garbage); i++) {
+    lenv_free(list_nth(garbage, i));
+  }
+  for (long i = 0; i < list_length(vectors); i++) {
+    lvector_free(list_nth(vectors, i));
+  }
+  list_free(garbage);
+  list_free(vectors);
+
+  clock_t pause = clock() - start;
+  lgc_created = 0;
+  lgc_collections++;
+  lgc_freed += freed;
+  lgc_pause_total += pause;
+  lgc_pause_max = max(lgc_pause_max, pause);
+  return freed;
+}
+
+/*
+ * Collect if enough environments and vectors were created since the
+ * last collection: at least lgc_threshold and lgc_growth percent of the
+ * heap that survived it. A threshold of 0 disables collection.
+ */
+void
+lgc_maybe ()
+{
+  if (lgc_threshold > 0 && ++lgc_created > max(lgc_threshold, lgc_heap_size * lgc_growth / 100)) {
+    lgc_collect();
+  }
+}
+
+lval *
+builtin_gc (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 0);
+  return lval_int(lgc_collect());
+}
+
+/*
+ * Return collections, objects freed, total and maximum pause in
+ * milliseconds.
+ */
+lval *
+builtin_gc_stats (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 0);
+  lval *stats = lval_lst();
+  lval_lst_append(stats, lval_int(lgc_collections));
+  lval_lst_append(stats, lval_int(lgc_freed));
+  lval_lst_append(stats, lval_num(1000.0 * lgc_pause_total / CLOCKS_PER_SEC));
+  lval_lst_append(stats, lval_num(1000.0 * lgc_pause_max / CLOCKS_PER_SEC));
+  return stats;
+}
+
+
+
+
+/**
+ *
+ * Images.
+ *
+ * An image is a snapshot of an environment and everything it reaches,
+ * written as a sequence of records. Each record creates one object and
+ * refers to objects of earlier records by number. An environment is
+ * written before anything that refers to it and its bindings last, so
+ * the cycles through environments need no fixups when read back. So is
+ * a vector, its members follow in a record of their own.
+ *
+ * Integers are written as variable length zigzag numbers, seven bits a
+ * byte, bignums as their sign, length and limbs in such numbers. Floats,
+ * also those of arrays, are written in host byte order; an image is only
+ * read by the build that wrote it.
+ *
+ */
+
+#define LIMAGE_MAGIC "LISPIMG1"
+
+typedef enum limage_tag {
+  IMG_NUM, IMG_INT, IMG_BIG, IMG_ARR, IMG_STR, IMG_SYM, IMG_ERR, IMG_LST,
+  IMG_FUN, IMG_VEC, IMG_BUILTIN, IMG_LFUN, IMG_LENV, IMG_LVARS, IMG_LCODE,
+  IMG_LVECTOR, IMG_BIND, IMG_MEMBERS, IMG_END
+} limage_tag;
+
+typedef struct limage_out {
+  FILE       *file;
+  lgc_heap    heap;             /* numbers of the objects written, in node->internal */
+  long        count;
+  tlist      *pending;          /* environments whose bindings are not written yet */
+  tlist      *vectors;          /* vectors whose members are not written yet */
+  const char *error;
+  int         data_only;        /* refuse functions */
+} limage_out;
+
+void
+limage_write (limage_out *out, const void *data, long size)
+{
+  fwrite(data, 1, size, out->file);
+}
+
+void
+limage_write_long (limage_out *out, long n)
+{
+  unsigned long u = ((unsigned long)n << 1) ^ (n < 0 ? ~0UL : 0);
+  unsigned char buf[10];
+  int length = 0;
+  do {
+    buf[length] = u & 0x7f;
+    u >>= 7;
+    if (u) {
+      buf[length] |= 0x80;
+    }
+    length++;
+  } while (u);
+  limage_write(out, buf, length);
+}
+
+void
+limage_write_longs (limage_out *out, const long *n, long length)
+{
+  for (long i = 0; i < length; i++) {
+    limage_write_long(out, n[i]);
+  }
+}
+
+void
+limage_write_tag (limage_out *out, limage_tag tag)
+{
+  char c = tag;
+  limage_write(out, &c, 1);
+}
+
+void
+limage_write_bytes (limage_out *out, const char *s, long length)
+{
+  limage_write_long(out, length);
+  limage_write(out, s, length);
+}
+
+/*
+ * Write LENGTH numbers IDS and free them.
+ */
+void
+limage_write_ids (limage_out *out, long *ids, long length)
+{
+  limage_write_long(out, length);
+  limage_write_longs(out, ids, length);
+  free(ids);
+}
+
+/*
+ * Start the record of a new object, returns its number.
+ */
+long
+limage_record (limage_out *out, limage_tag tag)
+{
+  limage_write_tag(out, tag);
+  return out->count++;
+}
+
+long limage_put (limage_out *out, void *ptr, lgc_kind kind);
+
+/*
+ * Write the members of LST, returns their numbers.
+ */
+long *
+limage_put_all (limage_out *out, tlist *lst, lgc_kind kind)
+{
+  long *ids = malloc(max(list_length(lst), 1) * sizeof(long));
+  for (long i = 0; i < list_length(lst); i++) {
+    ids[i] = limage_put(out, list_nth(lst, i), kind);
+  }
+  return ids;
+}
+
+long
+limage_put_lval (limage_out *out, lval *val)
+{
+  switch (val->type) {
+  case LVAL_NUM: {
+    long id = limage_record(out, IMG_NUM);
+    limage_write(out, &val->num, sizeof(double));
+    return id;
+  }
+  case LVAL_INT: {
+    long id = limage_record(out, IMG_INT);
+    limage_write_long(out, LVAL_INT_VALUE(val));
+    return id;
+  }
+  case LVAL_BIG: {
+    lbig *b = val->value;
+    long id = limage_record(out, IMG_BIG);
+    limage_write_long(out, b->negative);
+    limage_write_long(out, b->length);
+    for (long i = 0; i < b->length; i++) {
+      limage_write_long(out, b->limbs[i]);
+    }
+    return id;
+  }
+  case LVAL_ARR: {
+    larray *a = val->value;
+    long id = limage_record(out, IMG_ARR);
+    limage_write_long(out, a->kind);
+    limage_write_long(out, a->length);
+    limage_write(out, a->data, a->length * larray_kind_size(a->kind));
+    return id;
+  }
+  case LVAL_STR:
+  case LVAL_SYM:
+  case LVAL_ERR: {
+    limage_tag tag = (val->type == LVAL_STR) ? IMG_STR : (val->type == LVAL_SYM) ? IMG_SYM : IMG_ERR;
+    long id = limage_record(out, tag);
+    limage_write_bytes(out, val->value, strlen(val->value));
+    return id;
+  }
+  case LVAL_LST: {
+    long length = lval_lst_length(val);
+    long *ids = malloc(max(length, 1) * sizeof(long));
+    for (long i = 0; i < length; i++) {
+      ids[i] = limage_put(out, lval_lst_nth(val, i), GC_LVAL);
+    }
+    long id = limage_record(out, IMG_LST);
+    limage_write_long(out, val->is_quoted);
+    limage_write_ids(out, ids, length);
+    return id;
+  }
+  case LVAL_FUN: {
+    if (out->data_only) {
+      out->error = "cannot write function";
+      return -1;
+    }
+    long fun = limage_put(out, val->value, GC_LFUN);
+    long id = limage_record(out, IMG_FUN);
+    limage_write_long(out, fun);
+    return id;
+  }
+  case LVAL_VEC: {
+    long vec = limage_put(out, val->value, GC_LVEC);
+    long id = limage_record(out, IMG_VEC);
+    limage_write_long(out, vec);
+    return id;
+  }
+  case LVAL_TAIL:
+    break;
+  }
+  out->error = "cannot write tail call";
+  return -1;
+}
+
+long
+limage_put_lfun (limage_out *out, lfun *f)
+{
+  if (f->builtin) {
+    long i = lbuiltin_index(f->builtin);
+    if (i < 0) {
+      out->error = "cannot write unregistered builtin";
+      return -1;
+    }
+    long id = limage_record(out, IMG_BUILTIN);
+    limage_write_long(out, i);
+    limage_write_long(out, f->is_special);
+    return id;
+  }
+
+  long fields[] = {
+    limage_put(out, f->args, GC_LVAL),
+    limage_put(out, f->body, GC_LVAL),
+    limage_put(out, f->code, GC_LCODE),
+    limage_put(out, f->vars, GC_LVARS),
+    limage_put(out, f->env, GC_LENV),
+    f->is_special
+  };
+  long id = limage_record(out, IMG_LFUN);
+  limage_write_longs(out, fields, 6);
+  return id;
+}
+
+long
+limage_put_lvars (limage_out *out, lvars *vars)
+{
+  long parent = limage_put(out, vars->parent, GC_LVARS);
+  long *ids = malloc(max(vars->size, 1) * sizeof(long));
+  for (long i = 0; i < vars->size; i++) {
+    ids[i] = limage_put(out, vars->slots[i], GC_LVAL);
+  }
+  long id = limage_record(out, IMG_LVARS);
+  limage_write_long(out, parent);
+  limage_write_ids(out, ids, vars->size);
+  return id;
+}
+
+long
+limage_put_lcode (limage_out *out, lcode *code)
+{
+  long names = limage_put(out, code->names, GC_LVAL);
+  long *consts = limage_put_all(out, code->consts, GC_LVAL);
+  long *closures = limage_put_all(out, code->closures, GC_LCODE);
+  long *scopes = limage_put_all(out, code->scopes, GC_LVAL);
+
+  long id = limage_record(out, IMG_LCODE);
+  long fields[] = { names, code->restpos, code->has_rest, code->max_depth };
+  limage_write_longs(out, fields, 4);
+  limage_write_ids(out, consts, list_length(code->consts));
+  limage_write_ids(out, closures, list_length(code->closures));
+  limage_write_ids(out, scopes, list_length(code->scopes));
+  limage_write_long(out, code->length);
+  for (long i = 0; i < code->length; i++) {
+    limage_write_long(out, code->ops[i]);
+  }
+  return id;
+}
+
+/*
+ * Write PTR unless written already, returns its number or -1 for NULL.
+ */
+long
+limage_put (limage_out *out, void *ptr, lgc_kind kind)
+{
+  if (ptr == NULL || out->error) {
+    return -1;
+  }
+  lgc_node *node = lgc_node_get(&out->heap, ptr, kind);
+  if (node->live) {
+    return node->internal;
+  }
+
+  long id = -1;
+  switch (kind) {
+  case GC_LVAL: id = limage_put_lval(out, ptr); break;
+  case GC_LFUN: id = limage_put_lfun(out, ptr); break;
+  case GC_LVARS: id = limage_put_lvars(out, ptr); break;
+  case GC_LCODE: id = limage_put_lcode(out, ptr); break;
+  case GC_LENV: {
+    long parent = limage_put(out, ((lenv*)ptr)->parent, GC_LENV);
+    id = limage_record(out, IMG_LENV);
+    limage_write_long(out, parent);
+    list_append(out->pending, ptr);
+    break;
+  }
+  case GC_LVEC:
+    id = limage_record(out, IMG_LVECTOR);
+    list_append(out->vectors, ptr);
+    break;
+  case GC_LSTORE:
+    break;
+  }
+
+  // Only environments and vectors are shared by cycles, and they are
+  // numbered before their bindings or members are written.
+  node = lgc_slot(&out->heap, ptr);
+  node->live = 1;
+  node->internal = id;
+  return id;
+}
+
+/*
+ * Write the members of vector VEC.
+ */
+void
+limage_put_members (limage_out *out, lvector *vec)
+{
+  long *ids = limage_put_all(out, vec->members, GC_LVAL);
+  limage_write_tag(out, IMG_MEMBERS);
+  limage_write_long(out, lgc_slot(&out->heap, vec)->internal);
+  limage_write_ids(out, ids, list_length(vec->members));
+}
+
+/*
+ * Write the bindings of the environments and the members of the vectors
+ * written so far.
+ */
+void
+limage_put_bindings (limage_out *out)
+{
+  while ((list_length(out->pending) || list_length(out->vectors)) && !out->error) {
+    if (list_length(out->vectors)) {
+      limage_put_members(out, list_take(out->vectors, list_length(out->vectors) - 1));
+      continue;
+    }
+    lenv *env = list_take(out->pending, list_length(out->pending) - 1);
+    long *ids = malloc(max(env->size, 1) * sizeof(long));
+    for (long i = 0, n = 0; i < env->capacity; i++) {
+      if (env->names[i]) {
+        ids[n++] = limage_put(out, env->lvals[i], GC_LVAL);
+      }
+    }
+
+    limage_write_tag(out, IMG_BIND);
+    limage_write_long(out, lgc_slot(&out->heap, env)->internal);
+    limage_write_long(out, env->size);
+    for (long i = 0, n = 0; i < env->capacity; i++) {
+      if (env->names[i]) {
+        limage_write_bytes(out, env->names[i], strlen(env->names[i]));
+        limage_write_long(out, ids[n++]);
+      }
+    }
+    free(ids);
+  }
+}
+
+/*
+ * Write PTR of KIND and everything it reaches to FILENAME, after MAGIC
+ * and the LENGTH longs of HEADER. Returns nil or an error.
+ */
+lval *
+limage_write_file (const char *filename, const char *magic, const long *header, long length,
+                   void *ptr, lgc_kind kind, int data_only)
+{
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL) {
+    return lval_err("Unable to write %s", filename);
+  }
+
+  limage_out out = { file, { NULL, 0, 0, list() }, 0, list(), list(), NULL, data_only };
+  limage_write(&out, magic, strlen(magic));
+  if (header) {
+    limage_write_longs(&out, header, length);
+  }
+  long root = limage_put(&out, ptr, kind);
+  limage_put_bindings(&out);
+  limage_write_tag(&out, IMG_END);
+  limage_write_long(&out, root);
+
+  free(out.heap.nodes);
+  list_free(out.heap.work);
+  list_free(out.pending);
+  list_free(out.vectors);
+  if (fclose(file) != 0 && out.error == NULL) {
+    out.error = "write failed";
+  }
+  if (out.error) {
+    remove(filename);
+    return lval_err("Unable to write %s: %s", filename, out.error);
+  }
+  return LVAL_NIL();
+}
+
+/*
+ * Write ENV and everything it reaches to image FILENAME.
+ */
+lval *
+limage_save (lenv *env, const char *filename)
+{
+  return limage_write_file(filename, LIMAGE_MAGIC, NULL, 0, env, GC_LENV, 0);
+}
+
+typedef struct limage_in {
+  const char *pos;
+  const char *end;
+  void      **objects;
+  lgc_kind   *kinds;
+  long        count;
+  long        capacity;
+  int         bad;
+} limage_in;
+
+/*
+ * Copy SIZE bytes of input to DATA, zeros if the input is too short.
+ */
+void
+limage_read (limage_in *in, void *data, long size)
+{
+  if (in->bad || size > in->end - in->pos) {
+    in->bad = 1;
+    memset(data, 0, size);
+    return;
+  }
+  memcpy(data, in->pos, size);
+  in->pos += size;
+}
+
+long
+limage_read_long (limage_in *in)
+{
+  unsigned long u = 0;
+  for (int shift = 0; ; shift += 7) {
+    if (in->bad || in->pos == in->end || shift > 63) {
+      in->bad = 1;
+      return 0;
+    }
+    unsigned char c = *in->pos++;
+    u |= (unsigned long)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      break;
+    }
+  }
+  return (long)(u >> 1) ^ -(long)(u & 1);
+}
+
+void
+limage_read_longs (limage_in *in, long *n, long length)
+{
+  for (long i = 0; i < length; i++) {
+    n[i] = limage_read_long(in);
+  }
+}
+
+/*
+ * Return the bytes of a string in the input and their LENGTH, NULL if
+ * the input is too short.
+ */
+const char *
+limage_read_bytes (limage_in *in, long *length)
+{
+  *length = limage_read_long(in);
+  if (in->bad || *length < 0 || *length > in->end - in->pos) {
+    in->bad = 1;
+    *length = 0;
+    return NULL;
+  }
+  const char *s = in->pos;
+  in->pos += *length;
+  return s;
+}
+
+void
+limage_add (limage_in *in, void *ptr, lgc_kind kind)
+{
+  if (in->count == in->capacity) {
+    in->capacity = in->capacity ? 2 * in->capacity : 256;
+    in->objects = realloc(in->objects, in->capacity * sizeof(void*));
+    in->kinds = realloc(in->kinds, in->capacity * sizeof(lgc_kind));
+  }
+  in->objects[in->count] = ptr;
+  in->kinds[in->count] = kind;
+  in->count++;
+}
+
+/*
+ * Return object number ID, which must be of KIND, or NULL for -1.
+ */
+void *
+limage_get (limage_in *in, long id, lgc_kind kind)
+{
+  if (id == -1) {
+    return NULL;
+  }
+  if (id < 0 || id >= in->count || in->kinds[id] != kind) {
+    in->bad = 1;
+    return NULL;
+  }
+  return in->objects[id];
+}
+
+/*
+ * Read a count and as many numbers of objects of KIND, none of them
+ * NULL. Returns the objects, the caller frees the array.
+ */
+void **
+limage_read_ids (limage_in *in, lgc_kind kind, long *length)
+{
+  *length = limage_read_long(in);
+  if (*length < 0 || *length > in->end - in->pos) {
+    in->bad = 1;
+    *length = 0;
+  }
+  void **objects = malloc(max(*length, 1) * sizeof(void*));
+  for (long i = 0; i < *length; i++) {
+    objects[i] = limage_get(in, limage_read_long(in), kind);
+    if (objects[i] == NULL) {
+      in->bad = 1;
+    }
+  }
+  return objects;
+}
+
+/*
+ * Return a bignum, NULL if it is not written as one.
+ */
+lval *
+limage_read_big (limage_in *in)
+{
+  long negative = limage_read_long(in);
+  long length = limage_read_long(in);
+  if (in->bad || length < 2 || length > in->end - in->pos) {
+    in->bad = 1;
+    return NULL;
+  }
+  lbig *b = lbig_create(length);
+  b->negative = (negative != 0);
+  for (long i = 0; i < length; i++) {
+    long limb = limage_read_long(in);
+    if (limb < 0 || limb > UINT32_MAX) {
+      in->bad = 1;
+    }
+    b->limbs[i] = (uint32_t)limb;
+  }
+  if (in->bad || b->limbs[length - 1] == 0) {
+    in->bad = 1;
+    lbig_free(b);
+    return NULL;
+  }
+  return lval_big(b);
+}
+
+lval *
+limage_read_lst (limage_in *in)
+{
+  long quoted = limage_read_long(in);
+  long length;
+  void **members = limage_read_ids(in, GC_LVAL, &length);
+  if (in->bad) {
+    free(members);
+    return NULL;
+  }
+  lval *lst = lval_lst_sized(length);
+  for (long i = 0; i < length; i++) {
+    lval_lst_append(lst, lval_ref(members[i]));
+  }
+  lst->is_quoted = quoted;
+  free(members);
+  return lst;
+}
+
+lfun *
+limage_read_lfun (limage_in *in)
+{
+  long fields[6];
+  limage_read_longs(in, fields, 6);
+  lval *args = limage_get(in, fields[0], GC_LVAL);
+  lval *body = limage_get(in, fields[1], GC_LVAL);
+  lcode *code = limage_get(in, fields[2], GC_LCODE);
+  lvars *vars = limage_get(in, fields[3], GC_LVARS);
+  lenv *env = limage_get(in, fields[4], GC_LENV);
+  if (in->bad || !args || !body || !env) {
+    in->bad = 1;
+    return NULL;
+  }
+  if (code) {
+    code->refs++;
+  }
+  if (vars) {
+    vars->refs++;
+  }
+  lfun *f = lfun_closure(env, args, body, code, vars);
+  f->is_special = fields[5];
+  return f;
+}
+
+lvars *
+limage_read_lvars (limage_in *in)
+{
+  lvars *parent = limage_get(in, limage_read_long(in), GC_LVARS);
+  long size;
+  void **slots = limage_read_ids(in, GC_LVAL, &size);
+  if (in->bad) {
+    free(slots);
+    return NULL;
+  }
+  lvars *vars = malloc(sizeof(lvars) + size * sizeof(lval*));
+  vars->refs = 1;
+  vars->parent = parent;
+  if (parent) {
+    parent->refs++;
+  }
+  vars->size = size;
+  for (long i = 0; i < size; i++) {
+    vars->slots[i] = lval_ref(slots[i]);
+  }
+  free(slots);
+  return vars;
+}
+
+lcode *
+limage_read_lcode (limage_in *in)
+{
+  long fields[4];
+  limage_read_longs(in, fields, 4);
+  lval *names = limage_get(in, fields[0], GC_LVAL);
+  long nconsts, nclosures, nscopes;
+  void **consts = limage_read_ids(in, GC_LVAL, &nconsts);
+  void **closures = limage_read_ids(in, GC_LCODE, &nclosures);
+  void **scopes = limage_read_ids(in, GC_LVAL, &nscopes);
+  long length = limage_read_long(in);
+  if (length < 0 || length > in->end - in->pos || names == NULL) {
+    in->bad = 1;
+  }
+  if (in->bad) {
+    free(consts);
+    free(closures);
+    free(scopes);
+    return NULL;
+  }
+
+  lcode *code = malloc(sizeof(lcode));
+  code->ops = malloc(max(length, 1) * sizeof(int));
+  for (long i = 0; i < length; i++) {
+    code->ops[i] = limage_read_long(in);
+  }
+  code->length = length;
+  code->capacity = length;
+  code->consts = list();
+  code->closures = list();
+  code->scopes = list();
+  for (long i = 0; i < nconsts; i++) {
+    list_append(code->consts, lval_ref(consts[i]));
+  }
+  for (long i = 0; i < nclosures; i++) {
+    lcode *closure = closures[i];
+    closure->refs++;
+    list_append(code->closures, closure);
+  }
+  for (long i = 0; i < nscopes; i++) {
+    list_append(code->scopes, lval_ref(scopes[i]));
+  }
+  code->names = lval_ref(names);
+  code->restpos = fields[1];
+  code->has_rest = fields[2];
+  code->depth = 0;
+  code->max_depth = fields[3];
+  code->refs = 1;
+  free(consts);
+  free(closures);
+  free(scopes);
+  return code;
+}
+
+void
+limage_read_bindings (limage_in *in)
+{
+  lenv *env = limage_get(in, limage_read_long(in), GC_LENV);
+  long size = limage_read_long(in);
+  if (env == NULL || size < 0) {
+    in->bad = 1;
+  }
+  for (long i = 0; i < size && !in->bad; i++) {
+    long length;
+    const char *name = limage_read_bytes(in, &length);
+    lval *val = limage_get(in, limage_read_long(in), GC_LVAL);
+    if (name && val) {
+      lenv_put_key(env, string_intern_n(name, length), val);
+    } else {
+      in->bad = 1;
+    }
+  }
+}
+
+void
+limage_read_members (limage_in *in)
+{
+  lvector *vec = limage_get(in, limage_read_long(in), GC_LVEC);
+  long length;
+  void **members = limage_read_ids(in, GC_LVAL, &length);
+  if (vec == NULL) {
+    in->bad = 1;
+  }
+  for (long i = 0; i < length && !in->bad; i++) {
+    list_append(vec->members, lval_ref(members[i]));
+  }
+  free(members);
+}
+
+/*
+ * Read the records of an image, returns a reference to the object of
+ * KIND, an environment or a value, it ends with. Returns NULL if the
+ * records are not valid.
+ */
+void *
+limage_read_records (limage_in *in, lgc_kind kind)
+{
+  while (!in->bad) {
+    char tag;
+    limage_read(in, &tag, 1);
+    if (in->bad) {
+      break;
+    }
+
+    switch (tag) {
+    case IMG_NUM: {
+      double num;
+      limage_read(in, &num, sizeof(double));
+      limage_add(in, lval_num(num), GC_LVAL);
+      break;
+    }
+    case IMG_INT:
+      limage_add(in, lval_int(limage_read_long(in)), GC_LVAL);
+      break;
+    case IMG_BIG: {
+      lval *big = limage_read_big(in);
+      if (big) {
+        limage_add(in, big, GC_LVAL);
+      }
+      break;
+    }
+    case IMG_ARR: {
+      long kind = limage_read_long(in);
+      long length = limage_read_long(in);
+      if (in->bad || kind < LARRAY_F64 || kind > LARRAY_U8 || length < 0 ||
+          length > (in->end - in->pos) / larray_kind_size(kind)) {
+        in->bad = 1;
+        break;
+      }
+      larray *a = larray_create(kind, length);
+      limage_read(in, a->data, length * larray_kind_size(kind));
+      limage_add(in, lval_array(a), GC_LVAL);
+      break;
+    }
+    case IMG_STR:
+    case IMG_SYM:
+    case IMG_ERR: {
+      long length;
+      const char *s = limage_read_bytes(in, &length);
+      if (s) {
+        lval *val = (tag == IMG_SYM) ? lval_sym_n(s, length) : lval_str_n(s, length);
+        if (tag == IMG_ERR) {
+          val->type = LVAL_ERR;
+        }
+        limage_add(in, val, GC_LVAL);
+      }
+      break;
+    }
+    case IMG_LST: {
+      lval *lst = limage_read_lst(in);
+      if (lst) {
+        limage_add(in, lst, GC_LVAL);
+      }
+      break;
+    }
+    case IMG_FUN: {
+      lfun *f = limage_get(in, limage_read_long(in), GC_LFUN);
+      if (f) {
+        LVAL_ALLOC(val, LVAL_FUN);
+        val->value = lfun_copy(f);
+        limage_add(in, val, GC_LVAL);
+      } else {
+        in->bad = 1;
+      }
+      break;
+    }
+    case IMG_VEC: {
+      lvector *vec = limage_get(in, limage_read_long(in), GC_LVEC);
+      if (vec) {
+        limage_add(in, lval_vector(lvector_ref(vec)), GC_LVAL);
+      } else {
+        in->bad = 1;
+      }
+      break;
+    }
+    case IMG_BUILTIN: {
+      long i = limage_read_long(in);
+      long is_special = limage_read_long(in);
+      if (i >= 0 && i < NR_OF_BUILTINS) {
+        limage_add(in, lfun_builtin(lbuiltins[i].builtin, is_special), GC_LFUN);
+      } else {
+        in->bad = 1;
+      }
+      break;
+    }
+    case IMG_LFUN: {
+      lfun *f = limage_read_lfun(in);
+      if (f) {
+        limage_add(in, f, GC_LFUN);
+      }
+      break;
+    }
+    case IMG_LENV: {
+      lenv *parent = limage_get(in, limage_read_long(in), GC_LENV);
+      if (!in->bad) {
+        limage_add(in, lenv_create(parent), GC_LENV);
+      }
+      break;
+    }
+    case IMG_LVARS: {
+      lvars *vars = limage_read_lvars(in);
+      if (vars) {
+        limage_add(in, vars, GC_LVARS);
+      }
+      break;
+    }
+    case IMG_LCODE: {
+      lcode *code = limage_read_lcode(in);
+      if (code) {
+        limage_add(in, code, GC_LCODE);
+      }
+      break;
+    }
+    case IMG_LVECTOR:
+      limage_add(in, lvector_create(0), GC_LVEC);
+      break;
+    case IMG_BIND:
+      limage_read_bindings(in);
+      break;
+    case IMG_MEMBERS:
+      limage_read_members(in);
+      break;
+    case IMG_END: {
+      void *root = limage_get(in, limage_read_long(in), kind);
+      if (root) {
+        return (kind == GC_LENV) ? (void*)lenv_ref(root) : (void*)lval_ref(root);
+      }
+      in->bad = 1;
+      break;
+    }
+    default:
+      in->bad = 1;
+      break;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Read FILENAME written by limage_write_file(), the file is mapped and
+ * read in one pass. Returns the object of KIND it was written for, or
+ * NULL if it is not valid or its header differs from HEADER. A NULL
+ * HEADER matches any.
+ */
+void *
+limage_read_file (const char *filename, const char *magic, const long *header, long length,
+                  lgc_kind kind)
+{
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < strlen(magic)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  char *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return NULL;
+  }
+
+  limage_in in = { mapped, mapped + st.st_size, NULL, NULL, 0, 0, 0 };
+  void *root = NULL;
+  if (memcmp(mapped, magic, strlen(magic)) == 0) {
+    in.pos += strlen(magic);
+    for (long i = 0; i < length; i++) {
+      long n = limage_read_long(&in);
+      if (header && n != header[i]) {
+        in.bad = 1;
+      }
+    }
+    if (!in.bad) {
+      root = limage_read_records(&in, kind);
+    }
+  }
+  munmap(mapped, st.st_size);
+
+  // Drop the references of the table, objects live on in ROOT.
+  for (long i = in.count - 1; i >= 0; i--) {
+    switch (in.kinds[i]) {
+    case GC_LVAL: lval_free(in.objects[i]); break;
+    case GC_LFUN: lfun_free(in.objects[i]); break;
+    case GC_LENV: lenv_free(in.objects[i]); break;
+    case GC_LVARS: lvars_free(in.objects[i]); break;
+    case GC_LCODE: lcode_free(in.objects[i]); break;
+    case GC_LVEC: lvector_free(in.objects[i]); break;
+    case GC_LSTORE: break;
+    }
+  }
+  free(in.objects);
+  free(in.kinds);
+  return root;
+}
+
+/*
+ * Read environment from image FILENAME. Returns NULL if it is not a
+ * valid image.
+ */
+lenv *
+limage_load (const char *filename)
+{
+  return limage_read_file(filename, LIMAGE_MAGIC, NULL, 0, GC_LENV);
+}
+
+/*
+ * Save the global environment to an image.
+ */
+lval *
+builtin_save_image (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 1);
+  LVAL_LST_ASSERT_TYPE(arg, LVAL_STR);
+  while (env->parent) {
+    env = env->parent;
+  }
+  return limage_save(env, lval_lst_nth(arg, 0)->value);
+}
+
+
+
+/**
+ *
+ * Fasl files.
+ *
+ * A fasl file holds one value already read, numbers, strings, symbols
+ * and lists, in the records of an image. It is stamped with the size
+ * and a hash of the contents of the source it was read from, to tell
+ * when it is out of date. Modification times are too coarse for that,
+ * a source rewritten within the same tick would look unchanged.
+ *
+ */
+
+#define LFASL_MAGIC "LISPFSL2"
+
+/*
+ * Fill STAMP with the size and the hash of the contents of SOURCE, or
+ * -1 if it cannot be read.
+ */
+void
+lfasl_stamp (const char *source, long stamp[2])
+{
+  stamp[0] = -1;
+  stamp[1] = -1;
+  int fd = source ? open(source, O_RDONLY) : -1;
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+  const char *mapped = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return;
+  }
+  stamp[0] = st.st_size;
+  stamp[1] = (long)string_hash_n(mapped, st.st_size);
+  if (st.st_size) {
+    munmap((void*)mapped, st.st_size);
+  }
+}
+
+/*
+ * Write VAL to fasl FILENAME, stamped with SOURCE, which may be NULL.
+ * Returns nil or an error.
+ */
+lval *
+lfasl_save (const char *filename, lval *val, const char *source)
+{
+  long stamp[2];
+  lfasl_stamp(source, stamp);
+  return limage_write_file(filename, LFASL_MAGIC, stamp, 2, val, GC_LVAL, 1);
+}
+
+/*
+ * Read value from fasl FILENAME. Given SOURCE, the file must be stamped
+ * with its current size and contents. Returns NULL if the file is
+ * missing, out of date or not valid.
+ */
+lval *
+lfasl_load (const char *filename, const char *source)
+{
+  long stamp[2];
+  lfasl_stamp(source, stamp);
+  if (source && stamp[0] == -1) {
+    return NULL;
+  }
+  return limage_read_file(filename, LFASL_MAGIC, source ? stamp : NULL, 2, GC_LVAL);
+}
+
+/*
+ * (write-fasl file value [source])
+ */
+lval *
+builtin_write_fasl (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG_GE(arg, 2);
+  LVAL_ASSERT_NUMARG_LE(arg, 3);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_STR);
+  const char *source = NULL;
+  if (lval_lst_length(arg) == 3) {
+    LVAL_ASSERT_TYPE(lval_lst_nth(arg, 2), LVAL_STR);
+    source = lval_lst_nth(arg, 2)->value;
+  }
+  return lfasl_save(lval_lst_nth(arg, 0)->value, lval_lst_nth(arg, 1), source);
+}
+
+/*
+ * (load-fasl file [source]), given SOURCE an out of date FILE is read
+ * from SOURCE again and rewritten.
+ */
+lval *
+builtin_load_fasl (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG_GE(arg, 1);
+  LVAL_ASSERT_NUMARG_LE(arg, 2);
+  LVAL_LST_ASSERT_TYPE(arg, LVAL_STR);
+  const char *filename = lval_lst_nth(arg, 0)->value;
+  const char *source = (lval_lst_length(arg) == 2) ? lval_lst_nth(arg, 1)->value : NULL;
+
+  lval *val = lfasl_load(filename, source);
+  if (val) {
+    return val;
+  }
+  if (source == NULL) {
+    return lval_err("Unable to read fasl: %s", filename);
+  }
+
+  val = lread_file(source);
+  if (val->type != LVAL_ERR) {
+    // The value is good even if it cannot be cached.
+    lval_free(lfasl_save(filename, val, source));
+  }
+  return val;
+}
+
+
+
+
+/**
+ *
+ * Arrays.
+ *
+ * Arrays pack numbers of one kind: f64 floats, i64 integers or u8
+ * bytes. Like strings they are not modified once made; slicing and
+ * mapping return new arrays.
+ *
+ */
+
+/*
+ * Return member I of A as a number.
+ */
+lval *
+lval_array_nth (const larray *a, long i)
+{
+  if (a->kind == LARRAY_F64) {
+    return lval_num(LARRAY_F64(a)[i]);
+  }
+  return lval_int(larray_int(a, i));
+}
+
+/*
+ * Store number VAL as member I of A. Returns an error if it does not
+ * fit the kind of A, otherwise NULL.
+ */
+lval *
+lval_array_set (larray *a, long i, const lval *val)
+{
+  if (!LVAL_IS_NUMBER(val)) {
+    return lval_err("Wrong type of argument: number, %s", ltype_name(val->type));
+  }
+  if (a->kind == LARRAY_F64) {
+    LARRAY_F64(a)[i] = lnum_float(lnum_of(val));
+    return NULL;
+  }
+  if (val->type != LVAL_INT) {
+    return lval_err("Wrong type of argument: integer, %s", ltype_name(val->type));
+  }
+  if (a->kind == LARRAY_I64) {
+    LARRAY_I64(a)[i] = LVAL_INT_VALUE(val);
+    return NULL;
+  }
+  if (LVAL_INT_VALUE(val) < 0 || LVAL_INT_VALUE(val) > UINT8_MAX) {
+    return lval_err("Out of range for u8: %lld", (long long)LVAL_INT_VALUE(val));
+  }
+  LARRAY_U8(a)[i] = LVAL_INT_VALUE(val);
+  return NULL;
+}
+
+/*
+ * Return array of KIND holding the numbers in list ARG.
+ */
+lval *
+lval_array_of (larray_kind kind, const lval *arg)
+{
+  larray *a = larray_create(kind, lval_lst_length(arg));
+  for (long i = 0; i < a->length; i++) {
+    lval *err = lval_array_set(a, i, lval_lst_nth(arg, i));
+    if (err) {
+      larray_free(a);
+      return err;
+    }
+  }
+  return lval_array(a);
+}
+
+/*
+ * Return the sum or product of the members of A for P add or multiply,
+ * the least for P less than and the greatest for greater than. Sums and
+ * products of integers are exact.
+ */
+lval *
+lval_array_reduce (lprim p, const larray *a)
+{
+  if ((p == PRIM_LT || p == PRIM_GT) && a->length == 0) {
+    return lval_err("Empty array");
+  }
+  if (a->kind == LARRAY_F64) {
+    const double *x = LARRAY_F64(a);
+    switch (p) {
+    case PRIM_ADD: return lval_num(larray_sum(x, a->length));
+    case PRIM_MUL: return lval_num(larray_product(x, a->length));
+    case PRIM_LT:  return lval_num(larray_min(x, a->length));
+    default:       return lval_num(larray_max(x, a->length));
+    }
+  }
+
+  if (p == PRIM_LT || p == PRIM_GT) {
+    int64_t r = larray_int(a, 0);
+    for (long i = 1; i < a->length; i++) {
+      int64_t x = larray_int(a, i);
+      if ((p == PRIM_LT) ? x < r : x > r) {
+        r = x;
+      }
+    }
+    return lval_int(r);
+  }
+  lnum acc = { LVAL_INT, (p == PRIM_MUL), 0, NULL, 0 };
+  for (long i = 0; i < a->length; i++) {
+    lnum x = { LVAL_INT, larray_int(a, i), 0, NULL, 0 };
+    lnum_arith(p, &acc, x);
+  }
+  return lnum_lval(acc);
+}
+
+lval *
+builtin_f64_array (lenv *env, lval *arg)
+{
+  return lval_array_of(LARRAY_F64, arg);
+}
+
+lval *
+builtin_i64_array (lenv *env, lval *arg)
+{
+  return lval_array_of(LARRAY_I64, arg);
+}
+
+lval *
+builtin_u8_array (lenv *env, lval *arg)
+{
+  return lval_array_of(LARRAY_U8, arg);
+}
+
+lval *
+builtin_array_length (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 1);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_ARR);
+  return lval_int(((larray*)lval_lst_nth(arg, 0)->value)->length);
+}
+
+lval *
+builtin_array_ref (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_ARR);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 1), LVAL_INT);
+  const larray *a = lval_lst_nth(arg, 0)->value;
+  int64_t i = LVAL_INT_VALUE(lval_lst_nth(arg, 1));
+  if (i < 0 || i >= a->length) {
+    return lval_err("Index out of range: %ld, %lld", a->length, (long long)i);
+  }
+  return lval_array_nth(a, i);
+}
+
+/*
+ * Return the members of an array from a start up to an end index.
+ */
+lval *
+builtin_array_slice (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 3);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_ARR);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 1), LVAL_INT);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 2), LVAL_INT);
+  const larray *a = lval_lst_nth(arg, 0)->value;
+  int64_t start = LVAL_INT_VALUE(lval_lst_nth(arg, 1));
+  int64_t end = LVAL_INT_VALUE(lval_lst_nth(arg, 2));
+  if (start < 0 || start > end || end > a->length) {
+    return lval_err("Invalid slice: %lld, %lld of %ld", (long long)start, (long long)end, a->length);
+  }
+  return lval_array(larray_slice(a, start, end - start));
+}
+
+/*
+ * Return an array of the same kind holding a function applied to each
+ * member of an array.
+ */
+lval *
+builtin_array_map (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_FUN);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 1), LVAL_ARR);
+  lval *fun = lval_lst_nth(arg, 0);
+  const larray *a = lval_lst_nth(arg, 1)->value;
+
+  larray *r = larray_create(a->kind, a->length);
+  for (long i = 0; i < a->length; i++) {
+    lval *x = lval_lst_append(lval_lst(), lval_array_nth(a, i));
+    lval *y = lval_fun_call(env, fun, x);
+    lval_free(x);
+    lval *err = (y->type == LVAL_ERR) ? lval_ref(y) : lval_array_set(r, i, y);
+    lval_free(y);
+    if (err) {
+      larray_free(r);
+      return err;
+    }
+  }
+  return lval_array(r);
+}
+
+/*
+ * Combine an initial value and the members of an array from left to
+ * right with a function of two arguments.
+ */
+lval *
+builtin_array_reduce (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 3);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_FUN);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 2), LVAL_ARR);
+  lval *fun = lval_lst_nth(arg, 0);
+  const larray *a = lval_lst_nth(arg, 2)->value;
+
+  lval *acc = lval_ref(lval_lst_nth(arg, 1));
+  for (long i = 0; i < a->length && acc->type != LVAL_ERR; i++) {
+    lval *x = lval_lst_append(lval_lst_append(lval_lst(), acc), lval_array_nth(a, i));
+    acc = lval_fun_call(env, fun, x);
+    lval_free(x);
+  }
+  return acc;
+}
+
+/*
+ * Return the sum of the products of the members of two float arrays.
+ */
+lval *
+builtin_dot (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_LST_ASSERT_TYPE(arg, LVAL_ARR);
+  const larray *x = lval_lst_nth(arg, 0)->value;
+  const larray *y = lval_lst_nth(arg, 1)->value;
+  if (x->kind != LARRAY_F64 || y->kind != LARRAY_F64) {
+    return lval_err("Wrong type of argument: f64 array, %s array",
+                    larray_kind_name(x->kind != LARRAY_F64 ? x->kind : y->kind));
+  }
+  if (x->length != y->length) {
+    return lval_err("Arrays of different length: %ld, %ld", x->length, y->length);
+  }
+  return lval_num(larray_dot(LARRAY_F64(x), LARRAY_F64(y), x->length));
+}
+
+/*
+ * Read an array of the named kind from a file of its members in host
+ * byte order, without a header.
+ */
+lval *
+builtin_read_array (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_LST_ASSERT_TYPE(arg, LVAL_STR);
+  const char *name = lval_lst_nth(arg, 0)->value;
+  const char *filename = lval_lst_nth(arg, 1)->value;
+  int kind = larray_kind_of(name);
+  if (kind < 0) {
+    return lval_err("Unknown array kind: %s", name);
+  }
+
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return lval_err("Unable to open file: %s", filename);
+  }
+  long size = larray_kind_size(kind);
+  if (st.st_size % size != 0) {
+    close(fd);
+    return lval_err("File size is not a multiple of %ld: %s", size, filename);
+  }
+
+  larray *a = larray_create(kind, st.st_size / size);
+  long done = 0;
+  while (done < st.st_size) {
+    long n = read(fd, (char*)a->data + done, st.st_size - done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  close(fd);
+  if (done < st.st_size) {
+    larray_free(a);
+    return lval_err("Unable to read file: %s", filename);
+  }
+  return lval_array(a);
+}
+
+
+
+
+/**
+ *
+ * Vectors.
+ *
+ * Vectors hold values of any type in a growable array, so that a member
+ * is found and replaced in constant time and appending takes amortized
+ * constant time. Unlike lists they are modified in place: set-nth! and
+ * push! change the vector for everyone holding it.
+ *
+ */
+
+/*
+ * Set *I to index IDX, returns an error unless it is an integer below
+ * LENGTH.
+ */
+lval *
+lval_index (const lval *idx, long length, long *i)
+{
+  LVAL_ASSERT_TYPE(idx, LVAL_INT);
+  int64_t n = LVAL_INT_VALUE(idx);
+  if (n < 0 || n >= length) {
+    return lval_err("Index out of range: %ld, %lld", length, (long long)n);
+  }
+  *i = n;
+  return NULL;
+}
+
+lval *
+builtin_vector (lenv *env, lval *arg)
+{
+  lvector *vec = lvector_create(lval_lst_length(arg));
+  for (long i = 0; i < lval_lst_length(arg); i++) {
+    list_append(vec->members, lval_ref(lval_lst_nth(arg, i)));
+  }
+  return lval_vector(vec);
+}
+
+/*
+ * Return the member of a vector or list at an index.
+ */
+lval *
+builtin_nth (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  lval *seq = lval_lst_nth(arg, 0);
+  if (seq->type != LVAL_LST) {
+    LVAL_ASSERT_TYPE(seq, LVAL_VEC);
+  }
+  tlist *members = (seq->type == LVAL_VEC) ? ((lvector*)seq->value)->members : NULL;
+  long length = members ? list_length(members) : lval_lst_length(seq);
+  long i;
+  lval *err = lval_index(lval_lst_nth(arg, 1), length, &i);
+  if (err) {
+    return err;
+  }
+  return lval_ref(members ? list_nth(members, i) : lval_lst_nth(seq, i));
+}
+
+/*
+ * Replace the member of a vector at an index, returns the vector.
+ */
+lval *
+builtin_set_nth (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 3);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_VEC);
+  lval *vec = lval_lst_nth(arg, 0);
+  tlist *members = ((lvector*)vec->value)->members;
+  long i;
+  lval *err = lval_index(lval_lst_nth(arg, 1), list_length(members), &i);
+  if (err) {
+    return err;
+  }
+  lval_free(list_set(members, i, lval_ref(lval_lst_nth(arg, 2))));
+  return lval_ref(vec);
+}
+
+/*
+ * Append a value to a vector, returns the vector.
+ */
+lval *
+builtin_push (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 2);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_VEC);
+  lval *vec = lval_lst_nth(arg, 0);
+  list_append(((lvector*)vec->value)->members, lval_ref(lval_lst_nth(arg, 1)));
+  return lval_ref(vec);
+}
+
+/*
+ * Return the number of members of a vector or list.
+ */
+lval *
+builtin_len (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 1);
+  lval *seq = lval_lst_nth(arg, 0);
+  if (seq->type == LVAL_LST) {
+    return lval_int(lval_lst_length(seq));
+  }
+  LVAL_ASSERT_TYPE(seq, LVAL_VEC);
+  return lval_int(list_length(((lvector*)seq->value)->members));
+}
+
+/*
+ * Return a new vector of the members of a vector from a start up to an
+ * end index.
+ */
+lval *
+builtin_slice (lenv *env, lval *arg)
+{
+  LVAL_ASSERT_NUMARG(arg, 3);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 0), LVAL_VEC);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 1), LVAL_INT);
+  LVAL_ASSERT_TYPE(lval_lst_nth(arg, 2), LVAL_INT);
+  tlist *members = ((lvector*)lval_lst_nth(arg, 0)->value)->members;
+  int64_t start = LVAL_INT_VALUE(lval_lst_nth(arg, 1));
+  int64_t end = LVAL_INT_VALUE(lval_lst_nth(arg, 2));
+  if (start < 0 || start > end || end > list_length(members)) {
+    return lval_err("Invalid slice: %lld, %lld of %ld", (long long)start, (long long)end,
+                    list_length(members));
+  }
+  lvector *vec = lvector_create(end - start);
+  for (long i = start; i < end; i++) {
+    list_append(vec->members, lval_ref(list_nth(members, i)));
+  }
+  return lval_vector(vec);
 }
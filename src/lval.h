@@ -1,16 +1,23 @@
 #ifndef LVAL_H
 #define LVAL_H
 
+#include <stdint.h>
+
 #include "mpc/mpc.h"
 
 #define LVAL_NIL() lval_lst();
 #define LVAL_T()   lval_sym("t");
 
-typedef enum ltype { LVAL_ERR, LVAL_SYM, LVAL_NUM, LVAL_LST, LVAL_FUN, LVAL_STR } ltype;
+typedef enum ltype { LVAL_ERR, LVAL_SYM, LVAL_NUM, LVAL_LST, LVAL_FUN, LVAL_STR, LVAL_TAIL, LVAL_INT, LVAL_BIG, LVAL_ARR, LVAL_VEC } ltype;
 
 typedef struct lval lval;
 typedef struct lenv lenv;
 typedef struct lfun lfun;
+typedef struct lcode lcode;
+typedef struct lvars lvars;
+typedef struct lbig lbig;
+typedef struct larray larray;
+typedef struct lvector lvector;
 typedef enum   ltype ltype;
 typedef lval  *lbuiltin(lenv*, lval*);
 
@@ -18,29 +25,65 @@ lval * read_lval (mpc_ast_t *node);
 int    lval_type (const lval *val);
 
 lval * lval_eval  (lenv *env, lval *val);
+lval * lval_eval_unquoted (lenv *env, lval *val);
+lval * lval_ref   (lval *val);
 void   lval_free  (lval *val);
 void   lval_quote (lval *val);
 void   lval_print (const lval *val);
 lval * lval_err   (const char *fmt, ...);
 lval * lval_sym   (const char *name);
+lval * lval_sym_n (const char *name, long length);
 lval * lval_str   (const char *value);
-lval * lval_num   (float value);
+lval * lval_str_n (const char *value, long length);
+lval * lval_num   (double value);
+lval * lval_int   (int64_t value);
+lval * lval_big   (lbig *value);
+lval * lval_array (larray *value);
+lval * lval_vector (lvector *value);
+lval * lval_number (const char *s, long length);
 lval * lval_fun   (lbuiltin *builtin);
 lval * lval_lst   ();
 lval * lval_lst_insert (lval *lst, lval *val);
 lval * lval_lst_append (lval *lst, lval *val);
 
+lvector * lvector_create (long capacity);
+lvector * lvector_ref    (lvector *vec);
+void      lvector_free   (lvector *vec);
+
 lenv * lenv_create (lenv *parent);
+lenv * lenv_ref    (lenv *env);
 void   lenv_put    (lenv *env, const char *name, lval *val);
+void   lenv_put_sym (lenv *env, const lval *sym, lval *val);
+lval * lenv_get_sym (lenv *env, const lval *sym);
 void   lenv_free   (lenv *env);
 void   lenv_register_builtin (lenv *env, const char *name, lbuiltin *builtin, int is_special);
+void   lenv_register_builtins (lenv *env);
 
 lfun * lfun_builtin    (lbuiltin *builtin, int is_special);
 lfun * lfun_userdef    (lenv *env, lval *args, lval *body);
+lfun * lfun_closure    (lenv *env, lval *args, lval *body, lcode *code, lvars *vars);
 lfun * lfun_copy       (lfun *src);
 int    lfun_is_special (const lfun *fun);
 void   lfun_free       (lfun *fun);
 
+extern int lcode_enabled;
+
+lcode * lcode_compile (lenv *env, lval *args, lval *body);
+lval  * lcode_call    (lfun *fun, lval *arg);
+void    lcode_free    (lcode *code);
+void    lvars_free    (lvars *vars);
+
+extern long lgc_threshold;
+extern long lgc_growth;
+
+long lgc_collect ();
+void lgc_maybe   ();
+
+lval * limage_save (lenv *env, const char *filename);
+lenv * limage_load (const char *filename);
+lval * lfasl_save  (const char *filename, lval *val, const char *source);
+lval * lfasl_load  (const char *filename, const char *source);
+
 lval * builtin_identity (lenv *env, lval *arg);
 lval * builtin_lambda   (lenv *env, lval *arg);
 lval * builtin_add      (lenv *env, lval *arg);
@@ -49,6 +92,7 @@ lval * builtin_mul      (lenv *env, lval *arg);
 lval * builtin_div      (lenv *env, lval *arg);
 lval * builtin_head     (lenv *env, lval *arg);
 lval * builtin_tail     (lenv *env, lval *arg);
+lval * builtin_cons     (lenv *env, lval *arg);
 lval * builtin_list     (lenv *env, lval *arg);
 lval * builtin_join     (lenv *env, lval *arg);
 lval * builtin_eval     (lenv *env, lval *arg);
@@ -65,5 +109,29 @@ lval * builtin_le       (lenv *env, lval *arg);
 lval * builtin_eq       (lenv *env, lval *arg);
 lval * builtin_equal    (lenv *env, lval *arg);
 lval * builtin_load     (lenv *env, lval *arg);
+lval * builtin_gc       (lenv *env, lval *arg);
+lval * builtin_gc_stats (lenv *env, lval *arg);
+lval * builtin_save_image (lenv *env, lval *arg);
+lval * builtin_write_fasl (lenv *env, lval *arg);
+lval * builtin_load_fasl  (lenv *env, lval *arg);
+lval * builtin_apply    (lenv *env, lval *arg);
+lval * builtin_min      (lenv *env, lval *arg);
+lval * builtin_max      (lenv *env, lval *arg);
+lval * builtin_dot      (lenv *env, lval *arg);
+lval * builtin_f64_array (lenv *env, lval *arg);
+lval * builtin_i64_array (lenv *env, lval *arg);
+lval * builtin_u8_array  (lenv *env, lval *arg);
+lval * builtin_array_length (lenv *env, lval *arg);
+lval * builtin_array_ref    (lenv *env, lval *arg);
+lval * builtin_array_slice  (lenv *env, lval *arg);
+lval * builtin_array_map    (lenv *env, lval *arg);
+lval * builtin_array_reduce (lenv *env, lval *arg);
+lval * builtin_read_array   (lenv *env, lval *arg);
+lval * builtin_vector   (lenv *env, lval *arg);
+lval * builtin_nth      (lenv *env, lval *arg);
+lval * builtin_set_nth  (lenv *env, lval *arg);
+lval * builtin_push     (lenv *env, lval *arg);
+lval * builtin_len      (lenv *env, lval *arg);
+lval * builtin_slice    (lenv *env, lval *arg);
 
 #endif
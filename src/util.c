@@ -8,6 +8,8 @@
 #include <ctype.h>
 #include <string.h>
 
+#include "util.h"
+
 long
 min (long a, long b)
 {
@@ -20,6 +22,157 @@ max (long a, long b)
   return (a > b) ? a : b;
 }
 
+
+
+/*
+ * Pools of fixed size blocks. Blocks are carved from slabs with a bump
+ * pointer and recycled through a free list. Pools are thread-local.
+ * Building with MEM_MALLOC uses malloc and free instead, so tools like
+ * valgrind see every block.
+ */
+
+#define MEM_SLAB (64 * 1024)
+
+typedef struct mem_block {
+  struct mem_block *next;
+} mem_block;
+
+void *
+pool_alloc (mem_pool *pool)
+{
+#ifdef MEM_MALLOC
+  return malloc(pool->size);
+#else
+  mem_block *block = pool->free;
+  if (block) {
+    pool->free = block->next;
+    return block;
+  }
+
+  if (pool->left < pool->size) {
+    // The rest of the slab is too small, it is left unused.
+    pool->slab = malloc(MEM_SLAB);
+    pool->left = MEM_SLAB;
+  }
+  void *ptr = pool->slab;
+  pool->slab += pool->size;
+  pool->left -= pool->size;
+  return ptr;
+#endif
+}
+
+void
+pool_free (mem_pool *pool, void *ptr)
+{
+#ifdef MEM_MALLOC
+  free(ptr);
+#else
+  mem_block *block = ptr;
+  block->next = pool->free;
+  pool->free = block;
+#endif
+}
+
+
+
+/*
+ * Size class allocator for small blocks. Blocks of up to MEM_MAX bytes
+ * come from a pool per power of two size class, larger blocks from
+ * malloc. The caller passes the size of a block when releasing it.
+ */
+
+#define MEM_MIN 16
+#define MEM_MAX 1024
+
+static MEM_THREAD mem_pool mem_pools[] = {
+  MEM_POOL(16), MEM_POOL(32), MEM_POOL(64), MEM_POOL(128),
+  MEM_POOL(256), MEM_POOL(512), MEM_POOL(1024)
+};
+
+static int
+mem_class (size_t size)
+{
+  int class = 0;
+  while ((MEM_MIN << class) < size) {
+    class++;
+  }
+  return class;
+}
+
+void *
+mem_alloc (size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+  if (size > MEM_MAX) {
+    return malloc(size);
+  }
+  return pool_alloc(&mem_pools[mem_class(size)]);
+}
+
+void
+mem_free (void *ptr, size_t size)
+{
+  if (ptr == NULL) {
+    return;
+  }
+  if (size > MEM_MAX) {
+    free(ptr);
+    return;
+  }
+  pool_free(&mem_pools[mem_class(size)], ptr);
+}
+
+/*
+ * Resize block PTR of OLD bytes to SIZE bytes.
+ */
+void *
+mem_realloc (void *ptr, size_t old, size_t size)
+{
+  if (old > MEM_MAX && size > MEM_MAX) {
+    return realloc(ptr, size);
+  }
+#ifndef MEM_MALLOC
+  if (old && size && old <= MEM_MAX && size <= MEM_MAX && mem_class(old) == mem_class(size)) {
+    return ptr;
+  }
+#endif
+
+  void *dst = mem_alloc(size);
+  if (ptr && dst) {
+    memcpy(dst, ptr, min(old, size));
+  }
+  mem_free(ptr, old);
+  return dst;
+}
+
+char *
+mem_strdup (const char *s)
+{
+  size_t size = strlen(s) + 1;
+  return memcpy(mem_alloc(size), s, size);
+}
+
+/*
+ * Copy at most LENGTH bytes at S, stopping early at a zero byte.
+ */
+char *
+mem_strndup (const char *s, long length)
+{
+  const char *nul = memchr(s, 0, length);
+  size_t size = (nul ? nul - s : length) + 1;
+  char *d = memcpy(mem_alloc(size), s, size - 1);
+  d[size - 1] = 0;
+  return d;
+}
+
+void
+mem_strfree (char *s)
+{
+  mem_free(s, strlen(s) + 1);
+}
+
 
 
 char *
@@ -129,24 +282,169 @@ string_trim (char *s)
   return string_rtrim(string_ltrim(s));
 }
 
+unsigned long
+string_hash_n (const char *s, long length)
+{
+  unsigned long hash = 14695981039346656037UL;
+  for (long i = 0; i < length; i++) {
+    hash ^= (unsigned char)s[i];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+unsigned long
+string_hash (const char *s)
+{
+  return string_hash_n(s, strlen(s));
+}
+
+/*
+ * Process-wide table of interned strings, open addressing with linear
+ * probing. Interned strings are never freed.
+ */
+static char **interned = NULL;
+static long   interned_size = 0;
+static long   interned_capacity = 0;
+
+void
+string_intern_resize ()
+{
+  long    capacity = interned_capacity ? 2 * interned_capacity : 256;
+  char  **strings  = calloc(capacity, sizeof(char*));
+  for (long i = 0; i < interned_capacity; i++) {
+    if (interned[i]) {
+      unsigned long pos = string_hash(interned[i]) & (capacity - 1);
+      while (strings[pos]) {
+        pos = (pos + 1) & (capacity - 1);
+      }
+      strings[pos] = interned[i];
+    }
+  }
+  free(interned);
+  interned = strings;
+  interned_capacity = capacity;
+}
+
+/*
+ * Return the unique copy of string S. Two strings are equal iff their
+ * interned copies are the same pointer.
+ */
+const char *
+string_intern (const char *s)
+{
+  return string_intern_n(s, strlen(s));
+}
+
+/*
+ * Return the slot of the LENGTH bytes at S, which is empty if they are
+ * not interned.
+ */
+unsigned long
+string_intern_slot (const char *s, long length)
+{
+  unsigned long pos = string_hash_n(s, length) & (interned_capacity - 1);
+  while (interned[pos]) {
+    if (strncmp(interned[pos], s, length) == 0 && interned[pos][length] == 0) {
+      break;
+    }
+    pos = (pos + 1) & (interned_capacity - 1);
+  }
+  return pos;
+}
+
+/*
+ * Like string_intern() for the LENGTH bytes at S, which need not be
+ * terminated and must not contain a zero byte.
+ */
+const char *
+string_intern_n (const char *s, long length)
+{
+  if (2 * (interned_size + 1) > interned_capacity) {
+    string_intern_resize();
+  }
+  unsigned long pos = string_intern_slot(s, length);
+  if (interned[pos]) {
+    return interned[pos];
+  }
+  char *str = malloc(1 + length);
+  memcpy(str, s, length);
+  str[length] = 0;
+  interned[pos] = str;
+  interned_size++;
+  return str;
+}
+
+/*
+ * Return the interned copy of S, or NULL if S was never interned.
+ * Unlike string_intern() this does not add S to the table.
+ */
+const char *
+string_interned (const char *s)
+{
+  if (interned_capacity == 0) {
+    return NULL;
+  }
+  return interned[string_intern_slot(s, strlen(s))];
+}
+
 
 
-#define LIST_RESIZE(_l_) _l_->member = realloc(_l_->member, _l_->length * sizeof(void*));
+#define LIST_MIN_CAPACITY 4
 
+/*
+ * Lists grow geometrically and shrink lazily, once no more than a
+ * quarter of their capacity is used.
+ */
 typedef struct tlist {
   void **member;
   long   length;
+  long   capacity;
 } tlist;
 
+static MEM_THREAD mem_pool list_pool = MEM_POOL(sizeof(tlist));
+
+/*
+ * Return empty list with room for CAPACITY members.
+ */
 tlist *
-list ()
+list_sized (long capacity)
 {
-  tlist *lst = malloc(sizeof(tlist));
-  lst->member = NULL;
+  tlist *lst = pool_alloc(&list_pool);
+  lst->member = mem_alloc(capacity * sizeof(void*));
   lst->length = 0;
+  lst->capacity = capacity;
   return lst;
 }
 
+tlist *
+list ()
+{
+  return list_sized(0);
+}
+
+/*
+ * Make room for at least CAPACITY members.
+ */
+void
+list_reserve (tlist *lst, long capacity)
+{
+  if (capacity > lst->capacity) {
+    long old = lst->capacity;
+    lst->capacity = max(capacity, max(2 * lst->capacity, LIST_MIN_CAPACITY));
+    lst->member = mem_realloc(lst->member, old * sizeof(void*), lst->capacity * sizeof(void*));
+  }
+}
+
+void
+list_shrink (tlist *lst)
+{
+  if (lst->capacity > LIST_MIN_CAPACITY && 4 * lst->length <= lst->capacity) {
+    lst->capacity /= 2;
+    lst->member = mem_realloc(lst->member, 2 * lst->capacity * sizeof(void*), lst->capacity * sizeof(void*));
+  }
+}
+
 long
 list_length (const tlist *lst)
 {
@@ -162,19 +460,33 @@ list_nth (const tlist *lst, long pos)
   return lst->member[pos];
 }
 
+/*
+ * Replace member at POS with VAL, returns the old member.
+ */
+void *
+list_set (tlist *lst, long pos, void *val)
+{
+  if (pos >= lst->length) {
+    return NULL;
+  }
+  void *old = lst->member[pos];
+  lst->member[pos] = val;
+  return old;
+}
+
 void
 list_append (tlist *lst, void *val)
 {
+  list_reserve(lst, lst->length + 1);
   lst->length++;
-  LIST_RESIZE(lst);
   lst->member[lst->length - 1] = val;
 }
 
 void
 list_insert (tlist *lst, void *val)
 {
+  list_reserve(lst, lst->length + 1);
   lst->length++;
-  LIST_RESIZE(lst);
   memmove(&lst->member[1], lst->member, sizeof(void*) * (lst->length -1 ));
   lst->member[0] = val;
 }
@@ -194,13 +506,13 @@ list_take (tlist *lst, long pos)
   }
 
   lst->length--;
-  LIST_RESIZE(lst);
+  list_shrink(lst);
   return val;
 }
 
 void
 list_free (tlist *lst)
 {
-  free(lst->member);
-  free(lst);
+  mem_free(lst->member, lst->capacity * sizeof(void*));
+  pool_free(&list_pool, lst);
 }
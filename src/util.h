@@ -1,6 +1,31 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
+
+long   min (long a, long b);
+long   max (long a, long b);
+
+typedef struct mem_pool {
+  size_t  size;
+  void   *free;
+  char   *slab;
+  size_t  left;
+} mem_pool;
+
+#define MEM_POOL(_size_) { _size_, NULL, NULL, 0 }
+#define MEM_THREAD __thread
+
+void * pool_alloc  (mem_pool *pool);
+void   pool_free   (mem_pool *pool, void *ptr);
+
+void * mem_alloc   (size_t size);
+void   mem_free    (void *ptr, size_t size);
+void * mem_realloc (void *ptr, size_t old, size_t size);
+char * mem_strdup  (const char *s);
+char * mem_strndup (const char *s, long length);
+void   mem_strfree (char *s);
+
 char * string_unescape (const char *s);
 char * string_escape (const char *s);
 char * string_substring (const char *s, long start, long length);
@@ -8,15 +33,24 @@ char * string_ltrim (char *s);
 char * string_rtrim (char *s);
 char * string_trim  (char *s);
 
+unsigned long string_hash     (const char *s);
+unsigned long string_hash_n   (const char *s, long length);
+const char *  string_intern   (const char *s);
+const char *  string_intern_n (const char *s, long length);
+const char *  string_interned (const char *s);
+
 
 
 typedef struct tlist tlist;
 
 tlist * list ();
+tlist * list_sized  (long capacity);
+void    list_reserve (tlist *lst, long capacity);
 long    list_length (const tlist *lst);
 void  * list_nth    (const tlist *lst, long pos);
-void  * list_append (tlist *lst, void *val);
-void  * list_insert (tlist *lst, void *val);
+void  * list_set    (tlist *lst, long pos, void *val);
+void    list_append (tlist *lst, void *val);
+void    list_insert (tlist *lst, void *val);
 void  * list_take   (tlist *lst, long pos);
 void    list_free   (tlist *lst);
 
@@ -0,0 +1,98 @@
+#include "unity/unity.h"
+#include "../src/larray.c"
+
+/*
+ * Arrays of small integers, so that sums and products are exact in
+ * any order.
+ */
+larray *
+test_array (long length, long seed)
+{
+  larray *a = larray_create(LARRAY_F64, length);
+  for (long i = 0; i < length; i++) {
+    LARRAY_F64(a)[i] = (double)((i * 7 + seed) % 11) - 5;
+  }
+  return a;
+}
+
+void
+test_larray_reduce ()
+{
+  // Lengths around the vector width and the unrolled loop.
+  for (long n = 0; n < 40; n++) {
+    larray *a = test_array(n, 3);
+    double sum = 0;
+    double min = 100;
+    double max = -100;
+    for (long i = 0; i < n; i++) {
+      sum += LARRAY_F64(a)[i];
+      min = (LARRAY_F64(a)[i] < min) ? LARRAY_F64(a)[i] : min;
+      max = (LARRAY_F64(a)[i] > max) ? LARRAY_F64(a)[i] : max;
+    }
+    TEST_ASSERT_EQUAL_FLOAT(sum, larray_sum(LARRAY_F64(a), n));
+    if (n > 0) {
+      TEST_ASSERT_EQUAL_FLOAT(min, larray_min(LARRAY_F64(a), n));
+      TEST_ASSERT_EQUAL_FLOAT(max, larray_max(LARRAY_F64(a), n));
+    }
+    larray_free(a);
+  }
+
+  larray *a = larray_create(LARRAY_F64, 20);
+  double product = 1;
+  for (long i = 0; i < 20; i++) {
+    LARRAY_F64(a)[i] = (i % 3) ? 2 : -1;
+    product *= LARRAY_F64(a)[i];
+  }
+  TEST_ASSERT_EQUAL_FLOAT(product, larray_product(LARRAY_F64(a), 20));
+  TEST_ASSERT_EQUAL_FLOAT(1, larray_product(LARRAY_F64(a), 0));
+  larray_free(a);
+}
+
+void
+test_larray_dot ()
+{
+  for (long n = 0; n < 40; n++) {
+    larray *a = test_array(n, 1);
+    larray *b = test_array(n, 8);
+    double dot = 0;
+    for (long i = 0; i < n; i++) {
+      dot += LARRAY_F64(a)[i] * LARRAY_F64(b)[i];
+    }
+    TEST_ASSERT_EQUAL_FLOAT(dot, larray_dot(LARRAY_F64(a), LARRAY_F64(b), n));
+    larray *c = larray_copy(b);
+    TEST_ASSERT_EQUAL_FLOAT(dot, larray_dot(LARRAY_F64(c), LARRAY_F64(a), n));
+    larray_free(c);
+    larray_free(b);
+    larray_free(a);
+  }
+}
+
+void
+test_larray_slice ()
+{
+  larray *a = larray_create(LARRAY_U8, 5);
+  for (long i = 0; i < 5; i++) {
+    LARRAY_U8(a)[i] = 250 + i;
+  }
+  larray *s = larray_slice(a, 1, 3);
+  TEST_ASSERT_EQUAL(LARRAY_U8, s->kind);
+  TEST_ASSERT_EQUAL(3, s->length);
+  TEST_ASSERT_EQUAL(251, larray_int(s, 0));
+  TEST_ASSERT_EQUAL(253, larray_int(s, 2));
+  larray_free(s);
+  larray_free(a);
+
+  TEST_ASSERT_EQUAL(LARRAY_I64, larray_kind_of("i64"));
+  TEST_ASSERT_EQUAL(-1, larray_kind_of("i32"));
+  TEST_ASSERT_EQUAL_STRING("u8", larray_kind_name(LARRAY_U8));
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_larray_reduce);
+    RUN_TEST(test_larray_dot);
+    RUN_TEST(test_larray_slice);
+    return UNITY_END();
+}
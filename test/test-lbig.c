@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "unity/unity.h"
+
+// Split even small products, to compare against the schoolbook method.
+#define LBIG_KARATSUBA 4
+#include "../src/lbig.c"
+
+void
+assert_string (const char *expected, const lbig *b)
+{
+  char *s = lbig_string(b);
+  TEST_ASSERT_EQUAL_STRING(expected, s);
+  free(s);
+}
+
+void
+test_lbig_parse ()
+{
+  const char *s[] = { "0", "-1", "4294967296", "-9223372036854775808",
+                      "123456789012345678901234567890123456789" };
+  for (long i = 0; i < sizeof(s) / sizeof(*s); i++) {
+    lbig *b = lbig_parse(s[i], strlen(s[i]));
+    assert_string(s[i], b);
+    lbig_free(b);
+  }
+
+  lbig *b = lbig_parse("+000", 4);
+  TEST_ASSERT_EQUAL(0, b->length);
+  assert_string("0", b);
+  lbig_free(b);
+}
+
+void
+test_lbig_to_int ()
+{
+  int64_t n;
+  lbig *b = lbig_from_int(INT64_MIN);
+  TEST_ASSERT_TRUE(lbig_to_int(b, &n));
+  TEST_ASSERT_TRUE(n == INT64_MIN);
+  assert_string("-9223372036854775808", b);
+  lbig_free(b);
+
+  b = lbig_parse("9223372036854775808", 19);
+  TEST_ASSERT_FALSE(lbig_to_int(b, &n));
+  TEST_ASSERT_EQUAL_FLOAT(9223372036854775808.0, lbig_to_double(b));
+  lbig_free(b);
+}
+
+void
+test_lbig_add ()
+{
+  lbig *a = lbig_parse("18446744073709551615", 20);
+  lbig *one = lbig_from_int(1);
+  lbig *r = lbig_add(a, one);
+  assert_string("18446744073709551616", r);
+  TEST_ASSERT_EQUAL(3, r->length);
+
+  lbig *d = lbig_sub(one, r);
+  assert_string("-18446744073709551615", d);
+  TEST_ASSERT_EQUAL(-1, lbig_compare(d, one));
+  TEST_ASSERT_EQUAL(1, lbig_compare(r, a));
+
+  lbig *z = lbig_add(d, a);
+  TEST_ASSERT_EQUAL(0, z->length);
+  TEST_ASSERT_FALSE(z->negative);
+
+  lbig_free(z);
+  lbig_free(d);
+  lbig_free(r);
+  lbig_free(one);
+  lbig_free(a);
+}
+
+void
+test_lbig_mul ()
+{
+  lbig *a = lbig_parse("-99999999999999999999", 21);
+  lbig *r = lbig_mul(a, a);
+  assert_string("9999999999999999999800000000000000000001", r);
+  lbig_free(r);
+  lbig_free(a);
+
+  // Products of all shapes agree with the schoolbook method.
+  srand(1);
+  long sizes[] = { 4, 5, 7, 8, 9, 16, 31, 33, 64, 100 };
+  for (long i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+    for (long j = 0; j < sizeof(sizes) / sizeof(*sizes); j++) {
+      lbig *x = lbig_create(sizes[i]);
+      lbig *y = lbig_create(sizes[j]);
+      for (long k = 0; k < sizes[i]; k++) {
+        x->limbs[k] = (k % 3) ? UINT32_MAX : (uint32_t)rand();
+      }
+      for (long k = 0; k < sizes[j]; k++) {
+        y->limbs[k] = (k % 5) ? (uint32_t)rand() : UINT32_MAX;
+      }
+      lbig *z = lbig_mul(x, y);
+      lbig *w = lbig_create(sizes[i] + sizes[j]);
+      mag_mul_school(w->limbs, x->limbs, x->length, y->limbs, y->length);
+      lbig_trim(w);
+      TEST_ASSERT_EQUAL(0, lbig_compare(z, w));
+      lbig_free(w);
+      lbig_free(z);
+      lbig_free(y);
+      lbig_free(x);
+    }
+  }
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lbig_parse);
+    RUN_TEST(test_lbig_to_int);
+    RUN_TEST(test_lbig_add);
+    RUN_TEST(test_lbig_mul);
+    return UNITY_END();
+}
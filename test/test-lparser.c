@@ -4,11 +4,28 @@ extern char *strdup (const char *s);
 #include "unity/unity.h"
 #include "../src/lparser.c"
 
+void
+test_lparser_shared ()
+{
+  lparser *p = lparser_create();
+  lparser *q = lparser_create();
+  TEST_ASSERT_EQUAL_PTR(p->parsers, q->parsers);
+
+  // Each parser keeps its own result.
+  TEST_ASSERT_TRUE(lparser_parse(p, "(+ 1 2)"));
+  TEST_ASSERT_FALSE(lparser_parse(q, "(+ 1"));
+  TEST_ASSERT_NOT_NULL(lparser_ast(p));
+  free(lparser_error(q));
+  lparser_ast_delete(p);
+
+  lparser_delete(p);
+  lparser_delete(q);
+}
+
 int
 main()
 {
     UNITY_BEGIN();
-    lparser *p = lparser_create();
-    lparser_delete(p);
+    RUN_TEST(test_lparser_shared);
     return UNITY_END();
 }
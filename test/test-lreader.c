@@ -0,0 +1,213 @@
+#include <string.h>
+extern char *strdup (const char *s);
+extern int mkstemp (char *template);
+
+#include "unity/unity.h"
+#include "../src/lval.c"
+
+// Refill streams a few bytes at a time.
+#define LSTREAM_CHUNK 4
+#include "../src/lreader.c"
+
+lval *
+read_string (const char *s)
+{
+  return lread("<test>", s, strlen(s));
+}
+
+void
+test_lread_atoms ()
+{
+  lval *val = read_string("  -42 ");
+  TEST_ASSERT_EQUAL(LVAL_INT, lval_type(val));
+  TEST_ASSERT_EQUAL(-42, LVAL_INT_VALUE(val));
+  lval_free(val);
+
+  val = read_string("9007199254740993");
+  TEST_ASSERT_EQUAL(LVAL_INT, lval_type(val));
+  TEST_ASSERT_TRUE(LVAL_INT_VALUE(val) == 9007199254740993LL);
+  lval_free(val);
+
+  val = read_string("-123456789012345678901234567890");
+  TEST_ASSERT_EQUAL(LVAL_BIG, lval_type(val));
+  lval_free(val);
+
+  val = read_string("-2.5");
+  TEST_ASSERT_EQUAL(LVAL_NUM, lval_type(val));
+  TEST_ASSERT_EQUAL_FLOAT(-2.5, LVAL_NUM_VALUE(val));
+  lval_free(val);
+
+  val = read_string("+");
+  TEST_ASSERT_EQUAL(LVAL_SYM, lval_type(val));
+  TEST_ASSERT_EQUAL_PTR(string_intern("+"), val->value);
+  lval_free(val);
+
+  val = read_string("nil");
+  TEST_ASSERT_EQUAL(LVAL_LST, lval_type(val));
+  TEST_ASSERT_EQUAL(0, lval_lst_length(val));
+  lval_free(val);
+
+  val = read_string("\"a \\\" b\"");
+  TEST_ASSERT_EQUAL(LVAL_STR, lval_type(val));
+  TEST_ASSERT_EQUAL_STRING("a \\\" b", val->value);
+  lval_free(val);
+}
+
+void
+test_lread_list ()
+{
+  lval *val = read_string("(def f ; comment\n {1 (2) \"s\"})");
+  TEST_ASSERT_EQUAL(LVAL_LST, lval_type(val));
+  TEST_ASSERT_FALSE(lval_is_quoted(val));
+  TEST_ASSERT_EQUAL(3, lval_lst_length(val));
+
+  lval *body = lval_lst_nth(val, 2);
+  TEST_ASSERT_TRUE(lval_is_quoted(body));
+  TEST_ASSERT_EQUAL(3, lval_lst_length(body));
+  TEST_ASSERT_EQUAL(LVAL_LST, lval_type(lval_lst_nth(body, 1)));
+  TEST_ASSERT_EQUAL(LVAL_STR, lval_type(lval_lst_nth(body, 2)));
+  lval_free(val);
+
+  // A number followed by symbol characters is two atoms, as in mpc.
+  val = read_string("(1a)");
+  TEST_ASSERT_EQUAL(2, lval_lst_length(val));
+  lval_free(val);
+}
+
+void
+test_lread_error ()
+{
+  lval *val = read_string("(+ 1\n (2 3)");
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(val));
+  TEST_ASSERT_EQUAL_STRING("<test>:2:7: error: expected ')' at end of input", val->value);
+  lval_free(val);
+
+  val = read_string("1 2");
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(val));
+  lval_free(val);
+
+  val = read_string("{1 )");
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(val));
+  lval_free(val);
+
+  val = read_string("\"abc");
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(val));
+  lval_free(val);
+}
+
+void
+test_lread_mpc ()
+{
+  const char *s = "(list 1 {a -2} \"s\" nil)";
+  lval *val = read_string(s);
+  lreader_mpc = 1;
+  lval *mpc = read_string(s);
+  lreader_mpc = 0;
+
+  TEST_ASSERT_EQUAL(lval_lst_length(mpc), lval_lst_length(val));
+  for (long i = 0; i < lval_lst_length(val); i++) {
+    TEST_ASSERT_EQUAL(lval_type(lval_lst_nth(mpc, i)), lval_type(lval_lst_nth(val, i)));
+  }
+  lval_free(val);
+  lval_free(mpc);
+}
+
+void
+test_lread_file ()
+{
+  char filename[] = "/tmp/test-lreader-XXXXXX";
+  int fd = mkstemp(filename);
+  const char *s = "{a \"b\" 3} ; trailing comment\n";
+  TEST_ASSERT_EQUAL(strlen(s), write(fd, s, strlen(s)));
+  close(fd);
+
+  lval *val = lread_file(filename);
+  TEST_ASSERT_EQUAL(LVAL_LST, lval_type(val));
+  TEST_ASSERT_EQUAL(3, lval_lst_length(val));
+  TEST_ASSERT_EQUAL_PTR(string_intern("a"), lval_lst_nth(val, 0)->value);
+  TEST_ASSERT_EQUAL_STRING("b", lval_lst_nth(val, 1)->value);
+  lval_free(val);
+
+  fd = open(filename, O_WRONLY | O_TRUNC);
+  close(fd);
+  val = lread_file(filename);
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(val));
+  lval_free(val);
+  unlink(filename);
+
+  val = lread_file(filename);
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(val));
+  lval_free(val);
+}
+
+void
+test_lstream_read ()
+{
+  int fds[2];
+  TEST_ASSERT_EQUAL(0, pipe(fds));
+  const char *s = "(+ 1 2) ; comment\n{abc \"d e\"}\n12345 symbol\n  )";
+  TEST_ASSERT_EQUAL(strlen(s), write(fds[1], s, strlen(s)));
+  close(fds[1]);
+
+  lstream *stream = lstream_open("<pipe>", fds[0]);
+  lval *val = lstream_read(stream);
+  TEST_ASSERT_EQUAL(3, lval_lst_length(val));
+  lval_free(val);
+
+  val = lstream_read(stream);
+  TEST_ASSERT_TRUE(lval_is_quoted(val));
+  TEST_ASSERT_EQUAL_STRING("d e", lval_lst_nth(val, 1)->value);
+  lval_free(val);
+
+  val = lstream_read(stream);
+  TEST_ASSERT_EQUAL(LVAL_INT, lval_type(val));
+  TEST_ASSERT_EQUAL(12345, LVAL_INT_VALUE(val));
+  lval_free(val);
+
+  val = lstream_read(stream);
+  TEST_ASSERT_EQUAL_PTR(string_intern("symbol"), val->value);
+  lval_free(val);
+
+  val = lstream_read(stream);
+  TEST_ASSERT_EQUAL_STRING("<pipe>:4:3: error: expected expression at ')'", val->value);
+  lval_free(val);
+
+  lstream_close(stream);
+  close(fds[0]);
+}
+
+void
+test_lstream_load ()
+{
+  char filename[] = "/tmp/test-lreader-XXXXXX";
+  int fd = mkstemp(filename);
+  const char *s = "(def x 1)\n(def x (+ x 1))\n(+ x 40)\n";
+  TEST_ASSERT_EQUAL(strlen(s), write(fd, s, strlen(s)));
+  close(fd);
+
+  lenv *env = lenv_create(NULL);
+  lenv_register_builtin(env, "def", builtin_def, 1);
+  lenv_register_builtin(env, "+", builtin_add, 0);
+  lval *arg = lval_lst_append(lval_lst(), lval_str(filename));
+  lval *val = builtin_load(env, arg);
+  TEST_ASSERT_EQUAL(LVAL_INT, lval_type(val));
+  TEST_ASSERT_EQUAL(42, LVAL_INT_VALUE(val));
+  lval_free(val);
+  lval_free(arg);
+  lenv_free(env);
+  unlink(filename);
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lread_atoms);
+    RUN_TEST(test_lread_list);
+    RUN_TEST(test_lread_error);
+    RUN_TEST(test_lread_mpc);
+    RUN_TEST(test_lread_file);
+    RUN_TEST(test_lstream_read);
+    RUN_TEST(test_lstream_load);
+    return UNITY_END();
+}
@@ -25,8 +25,8 @@ test_lenv_get ()
   lenv_put(env, "one", one);
 
   lval *two = lenv_get(env, "one");
-  TEST_ASSERT_NOT_EQUAL(one, two);
-  TEST_ASSERT_EQUAL_STRING(one->value, two->value);
+  TEST_ASSERT_EQUAL(one, two);
+  TEST_ASSERT_EQUAL(3, two->refs);
 
   lval_free(one);
   lval_free(two);
@@ -34,6 +34,31 @@ test_lenv_get ()
 
 }
 
+void
+test_lenv_get_many ()
+{
+  lenv *env = lenv_create(NULL);
+  char name[16];
+
+  for (long i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "name%ld", i);
+    lval *num = lval_num(i);
+    lenv_put(env, name, num);
+    lval_free(num);
+  }
+  TEST_ASSERT_EQUAL(1000, env->size);
+
+  for (long i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "name%ld", i);
+    lval *num = lenv_get(env, name);
+    TEST_ASSERT_EQUAL(LVAL_NUM, num->type);
+    TEST_ASSERT_EQUAL_FLOAT(i, LVAL_NUM_VALUE(num));
+    lval_free(num);
+  }
+
+  lenv_free(env);
+}
+
 void
 test_lenv_get_err ()
 {
@@ -41,6 +66,12 @@ test_lenv_get_err ()
   lval *err = lenv_get(env, "one");
 
   TEST_ASSERT_EQUAL(LVAL_ERR, err->type);
+  lval_free(err);
+
+  // Looking up an unbound name does not intern it.
+  err = lenv_get(env, "never bound");
+  TEST_ASSERT_EQUAL(LVAL_ERR, err->type);
+  TEST_ASSERT_NULL(string_interned("never bound"));
 
   lval_free(err);
   lenv_free(env);
@@ -52,12 +83,46 @@ void test_lval_sym_leak ()
   lval_free(sym);
 }
 
+void test_lval_sym_interned ()
+{
+  lval *a = lval_sym("Symbol");
+  lval *b = lval_sym("Symbol");
+  TEST_ASSERT_EQUAL_PTR(a->value, b->value);
+  lval_free(a);
+  lval_free(b);
+}
+
 void test_lval_num_leak ()
 {
   lval *num = lval_num(8192);
   lval_free(num);
 }
 
+void test_lval_num_copy ()
+{
+  lval *num = lval_num(8192);
+  lval *dst = lval_copy(num);
+  TEST_ASSERT_EQUAL_FLOAT(8192, LVAL_NUM_VALUE(dst));
+  lval_free(num);
+  lval_free(dst);
+}
+
+void test_lval_unshare ()
+{
+  lval *lst = lval_lst_append(lval_lst(), lval_num(8192));
+  lval *dst = lval_unshare(lval_ref(lst));
+
+  TEST_ASSERT_NOT_EQUAL(lst, dst);
+  TEST_ASSERT_EQUAL(lval_lst_nth(lst, 0), lval_lst_nth(dst, 0));
+
+  lval_free(lval_lst_take(dst, 0));
+  TEST_ASSERT_EQUAL(1, lval_lst_length(lst));
+  TEST_ASSERT_EQUAL(dst, lval_unshare(dst));
+
+  lval_free(lst);
+  lval_free(dst);
+}
+
 void test_lval_eval_sym ()
 {
   lval *num = lval_num(8192);
@@ -93,6 +158,26 @@ test_lval_eval_lst ()
   TEST_ASSERT_EQUAL(LVAL_LST, dst->type);
   TEST_ASSERT_EQUAL(1, lval_lst_length(dst));
   TEST_ASSERT_EQUAL(LVAL_NUM, lval_lst_nth(dst, 0)->type);
+  TEST_ASSERT_EQUAL(1, lval_lst_length(lst));
+  lval_free(dst);
+
+  // Calls with thousands of arguments evaluate them into one list.
+  lenv_register_builtin(env, "+", builtin_add, 0);
+  lenv_register_builtin(env, "list", builtin_list, 0);
+  lval *add = lval_lst_append(lval_lst(), lval_sym("+"));
+  lval *list = lval_lst_append(lval_lst(), lval_sym("list"));
+  for (long i = 0; i < 5000; i++) {
+    lval_lst_append(add, lval_num(1));
+    lval_lst_append(list, lval_num(i));
+  }
+  dst = lval_eval(env, add);
+  TEST_ASSERT_EQUAL(LVAL_NUM, dst->type);
+  TEST_ASSERT_EQUAL_FLOAT(5000, LVAL_NUM_VALUE(dst));
+  lval_free(dst);
+  dst = lval_eval(env, list);
+  TEST_ASSERT_EQUAL(LVAL_LST, dst->type);
+  TEST_ASSERT_EQUAL(5000, lval_lst_length(dst));
+  TEST_ASSERT_EQUAL_FLOAT(4999, LVAL_NUM_VALUE(lval_lst_nth(dst, 4999)));
 
   lval_free(num);
   lval_free(dst);
@@ -133,18 +218,627 @@ test_builtin_identity ()
   lenv_free(env);
 }
 
+lval *
+read_string (const char *s)
+{
+  lparser *p = lparser_create();
+  TEST_ASSERT_TRUE(lparser_parse(p, s));
+  lval *val = read_lval(lparser_ast(p));
+  lparser_ast_delete(p);
+  lparser_delete(p);
+  return val;
+}
+
+void
+test_lval_eval_tail_call ()
+{
+  lenv *env = lenv_create(NULL);
+  lenv_register_builtin(env, "lambda", builtin_lambda, 1);
+  lenv_register_builtin(env, "def", builtin_def, 1);
+  lenv_register_builtin(env, "if", builtin_if, 1);
+  lenv_register_builtin(env, "=", builtin_eq, 0);
+  lenv_register_builtin(env, "-", builtin_sub, 0);
+
+  lval_free(lval_eval(env, read_string("(def count (lambda {n} {if (= n 0) {done} (count (- n 1))}))")));
+  lval *val = lval_eval(env, read_string("(count 100000)"));
+  TEST_ASSERT_EQUAL(LVAL_LST, val->type);
+  lval_free(val);
+
+  // The last operand of and and or is in tail position too.
+  lenv_register_builtin(env, "and", builtin_and, 1);
+  lenv_register_builtin(env, "or", builtin_or, 1);
+  lenv_register_builtin(env, "<", builtin_lt, 0);
+  lval_free(lval_eval(env, read_string("(def lor (lambda {n} {or (= n 0) (lor (- n 1))}))")));
+  lval_free(lval_eval(env, read_string("(def land (lambda {n} {and (< 0 n) (land (- n 1))}))")));
+  val = lval_eval(env, read_string("(lor 100000)"));
+  TEST_ASSERT_FALSE(LVAL_IS_NIL(val));
+  lval_free(val);
+  val = lval_eval(env, read_string("(land 100000)"));
+  TEST_ASSERT_TRUE(LVAL_IS_NIL(val));
+  lval_free(val);
+  TEST_ASSERT_TRUE(lvm_frames_capacity <= 64);
+
+  lenv_free(env);
+}
+
+lenv *
+test_env ()
+{
+  lenv *env = lenv_create(NULL);
+  lenv_register_builtin(env, "lambda", builtin_lambda, 1);
+  lenv_register_builtin(env, "def", builtin_def, 1);
+  lenv_register_builtin(env, "if", builtin_if, 1);
+  lenv_register_builtin(env, "and", builtin_and, 1);
+  lenv_register_builtin(env, "=", builtin_eq, 0);
+  lenv_register_builtin(env, "<", builtin_lt, 0);
+  lenv_register_builtin(env, "+", builtin_add, 0);
+  lenv_register_builtin(env, "-", builtin_sub, 0);
+  lenv_register_builtin(env, "list", builtin_list, 0);
+  return env;
+}
+
+static long ticks = 0;
+
+lval *
+builtin_tick (lenv *env, lval *arg)
+{
+  return lval_num(++ticks);
+}
+
+void
+test_lcode_compile ()
+{
+  lenv *env = test_env();
+
+  lval *fib = lval_eval(env, read_string("(def fib (lambda {n} {if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))}))"));
+  TEST_ASSERT_NOT_NULL(((lfun*)fib->value)->code);
+  lval *val = lval_eval(env, read_string("(fib 15)"));
+  TEST_ASSERT_EQUAL(LVAL_INT, val->type);
+  TEST_ASSERT_EQUAL(610, LVAL_INT_VALUE(val));
+  lval_free(val);
+  lval_free(fib);
+
+  lval *rest = lval_eval(env, read_string("(lambda {a &rest b} {and a (list a b)})"));
+  TEST_ASSERT_NOT_NULL(((lfun*)rest->value)->code);
+  lval_free(rest);
+
+  lval *def = lval_eval(env, read_string("(lambda {n} {def m n})"));
+  TEST_ASSERT_NULL(((lfun*)def->value)->code);
+  lval_free(def);
+
+  // A special form passed as a function evaluates its arguments once.
+  lenv_register_builtin(env, "or", builtin_or, 1);
+  lenv_register_builtin(env, "tick", builtin_tick, 0);
+  lval *f = lval_eval(env, read_string("(def f (lambda {op} {list (op (tick) 2) (op (tick) 3)}))"));
+  TEST_ASSERT_NOT_NULL(((lfun*)f->value)->code);
+  lval_free(f);
+  ticks = 0;
+  lval_free(lval_eval(env, read_string("(f and)")));
+  lval_free(lval_eval(env, read_string("(f or)")));
+  lval_free(lval_eval(env, read_string("(f list)")));
+  TEST_ASSERT_EQUAL(6, ticks);
+  val = lval_eval(env, read_string("((lambda {op} {op (= 0 1) (tick)}) and)"));
+  TEST_ASSERT_TRUE(LVAL_IS_NIL(val));
+  lval_free(val);
+  TEST_ASSERT_EQUAL(6, ticks);
+
+  // Rebinding a primitive or a special form after compilation is seen
+  // by the compiled code, which then evaluates the arguments once.
+  lval_free(lval_eval(env, read_string("(def h (lambda {} {= (tick) 1}))")));
+  lval_free(lval_eval(env, read_string("(def g (lambda {} {if (tick) 1 2}))")));
+  lval_free(lval_eval(env, read_string("(def = or)")));
+  val = lval_eval(env, read_string("(h)"));
+  TEST_ASSERT_EQUAL(LVAL_NUM, val->type);
+  TEST_ASSERT_EQUAL_FLOAT(7, LVAL_NUM_VALUE(val));
+  lval_free(val);
+  TEST_ASSERT_EQUAL(7, ticks);
+  lval_free(lval_eval(env, read_string("(def if list)")));
+  val = lval_eval(env, read_string("(g)"));
+  TEST_ASSERT_EQUAL(LVAL_LST, val->type);
+  TEST_ASSERT_EQUAL(3, lval_lst_length(val));
+  lval_free(val);
+  TEST_ASSERT_EQUAL(8, ticks);
+
+  lenv_free(env);
+}
+
+void
+test_lcode_closure ()
+{
+  lenv *env = test_env();
+
+  lval *adder = lval_eval(env, read_string("(lambda {x} {lambda {y} {lambda {z} {list x y z}}})"));
+  TEST_ASSERT_NOT_NULL(((lfun*)adder->value)->code);
+  lval_free(adder);
+  lval *val = lval_eval(env, read_string("((((lambda {x} {lambda {y} {lambda {z} {list x y z}}}) 1) 2) 3)"));
+  TEST_ASSERT_EQUAL(LVAL_LST, val->type);
+  TEST_ASSERT_EQUAL(3, lval_lst_length(val));
+  TEST_ASSERT_EQUAL(1, LVAL_INT_VALUE(lval_lst_nth(val, 0)));
+  TEST_ASSERT_EQUAL(3, LVAL_INT_VALUE(lval_lst_nth(val, 2)));
+  lval_free(val);
+
+  lval *def = lval_eval(env, read_string("(lambda {n} {lambda {m} {def k m}})"));
+  TEST_ASSERT_NULL(((lfun*)def->value)->code);
+  lval_free(def);
+
+  lenv_free(env);
+}
+
+void
+test_lfun_shared_env ()
+{
+  lenv *env = test_env();
+
+  lval *fun = lval_eval(env, read_string("(lambda {x} {list x})"));
+  TEST_ASSERT_EQUAL_PTR(env, ((lfun*)fun->value)->env);
+  lval *copy = lval_copy(fun);
+  TEST_ASSERT_EQUAL_PTR(fun->value, copy->value);
+  lval_free(copy);
+  lval_free(fun);
+  TEST_ASSERT_EQUAL(1, env->refs);
+
+  lenv_free(env);
+}
+
+void
+test_lgc_collect ()
+{
+  lgc_collect();
+  lenv *env = test_env();
+  lval_free(lval_eval(env, read_string("(def loop (lambda {n} {if (= n 0) n (loop (- n 1))}))")));
+  TEST_ASSERT_EQUAL(0, lgc_collect());
+
+  lval *val = lval_eval(env, read_string("(loop 10)"));
+  TEST_ASSERT_EQUAL(0, LVAL_INT_VALUE(val));
+  lval_free(val);
+
+  lenv_free(env);
+  TEST_ASSERT_TRUE(lgc_collect() > 0);
+  TEST_ASSERT_NULL(lenv_all);
+}
+
+void
+test_lval_lst_shared ()
+{
+  lval *lst = lval_lst();
+  for (long i = 0; i < 10; i++) {
+    lval_lst_append(lst, lval_num(i));
+  }
+  lval *arg = lval_lst_append(lval_lst(), lst);
+
+  lval *tail = builtin_tail(NULL, arg);
+  TEST_ASSERT_EQUAL(9, lval_lst_length(tail));
+  TEST_ASSERT_EQUAL_PTR(lval_lst_nth(lst, 1), lval_lst_nth(tail, 0));
+  TEST_ASSERT_EQUAL_PTR(((llist*)lst->value)->store, ((llist*)tail->value)->store);
+
+  lval *cons = lval_lst_append(lval_lst_append(lval_lst(), lval_num(-1)), lval_ref(lst));
+  lval *one = builtin_cons(NULL, cons);
+  lval_free(cons);
+  cons = lval_lst_append(lval_lst_append(lval_lst(), lval_num(-2)), lval_ref(one));
+  lval *two = builtin_cons(NULL, cons);
+  TEST_ASSERT_EQUAL(12, lval_lst_length(two));
+  TEST_ASSERT_EQUAL_FLOAT(-2, LVAL_NUM_VALUE(lval_lst_nth(two, 0)));
+  TEST_ASSERT_EQUAL_FLOAT(9, LVAL_NUM_VALUE(lval_lst_nth(two, 11)));
+  TEST_ASSERT_EQUAL_PTR(((llist*)one->value)->store, ((llist*)two->value)->store);
+  TEST_ASSERT_EQUAL(11, lval_lst_length(one));
+  TEST_ASSERT_EQUAL(10, lval_lst_length(lst));
+
+  // Taking the first member of an unshared list releases its slot.
+  lval *head = lval_lst();
+  lval *own = lval_lst_append(lval_lst_append(lval_lst(), lval_ref(head)), lval_num(1));
+  lval_free(lval_lst_take(own, 0));
+  TEST_ASSERT_EQUAL(1, head->refs);
+  lval_lst_insert(own, lval_ref(head));
+  lval_free(lval_lst_take(lval_lst_append(own, lval_num(2)), 0));
+  TEST_ASSERT_EQUAL(2, lval_lst_length(own));
+  TEST_ASSERT_EQUAL(1, head->refs);
+  lval_free(own);
+  lval_free(head);
+
+  lval_free(two);
+  lval_free(cons);
+  lval_free(one);
+  lval_free(tail);
+  lval_free(arg);
+}
+
+void
+test_lnum_arith ()
+{
+  lenv *env = test_env();
+  lenv_register_builtin(env, "*", builtin_mul, 0);
+  lenv_register_builtin(env, "/", builtin_div, 0);
+  lval_free(lval_eval(env, read_string("(def add (lambda {a b} {+ a b}))")));
+
+  const char *exprs[] = { "(+ 16777216 1)", "(add 16777216 1)", "(/ 6 3)", "(- 5)" };
+  int64_t ints[] = { 16777217, 16777217, 2, -5 };
+  TEST_ASSERT_EQUAL(sizeof(exprs) / sizeof(*exprs), sizeof(ints) / sizeof(*ints));
+  for (long i = 0; i < sizeof(exprs) / sizeof(*exprs); i++) {
+    lval *val = lval_eval(env, read_string(exprs[i]));
+    TEST_ASSERT_EQUAL(LVAL_INT, val->type);
+    TEST_ASSERT_TRUE(LVAL_INT_VALUE(val) == ints[i]);
+    lval_free(val);
+  }
+
+  // Fractions continue as floats, overflow as bignums.
+  lval *val = lval_eval(env, read_string("(/ 7 2)"));
+  TEST_ASSERT_EQUAL(LVAL_NUM, val->type);
+  TEST_ASSERT_EQUAL_FLOAT(3.5, LVAL_NUM_VALUE(val));
+  lval_free(val);
+  val = lval_eval(env, read_string("(* 4294967296 -4294967296)"));
+  TEST_ASSERT_EQUAL(LVAL_BIG, val->type);
+  lval_free(val);
+  val = lval_eval(env, read_string("(add 9223372036854775807 1)"));
+  TEST_ASSERT_EQUAL(LVAL_BIG, val->type);
+  lval_free(val);
+
+  val = lval_eval(env, read_string("(list (< 1 1.5) (= 2 2.0) (< 9007199254740993 9007199254740992))"));
+  TEST_ASSERT_EQUAL(LVAL_SYM, lval_lst_nth(val, 0)->type);
+  TEST_ASSERT_EQUAL(LVAL_SYM, lval_lst_nth(val, 1)->type);
+  TEST_ASSERT_TRUE(LVAL_IS_NIL(lval_lst_nth(val, 2)));
+  lval_free(val);
+
+  val = lval_eval(env, read_string("(/ 1 0)"));
+  TEST_ASSERT_EQUAL(LVAL_ERR, val->type);
+  lval_free(val);
+  lenv_free(env);
+}
+
+void
+test_lbig_promote ()
+{
+  lenv *env = test_env();
+  lenv_register_builtin(env, "*", builtin_mul, 0);
+  lenv_register_builtin(env, "/", builtin_div, 0);
+  lenv_register_builtin(env, ">", builtin_gt, 0);
+  lenv_register_builtin(env, "equal", builtin_equal, 0);
+  lval_free(lval_eval(env, read_string("(def mul (lambda {a b} {* a b}))")));
+
+  // Products past 64 bits stay exact and come back down when they fit.
+  lval *val = lval_eval(env, read_string("(mul 9223372036854775807 9223372036854775807)"));
+  TEST_ASSERT_EQUAL(LVAL_BIG, val->type);
+  char *s = lbig_string(val->value);
+  TEST_ASSERT_EQUAL_STRING("85070591730234615847396907784232501249", s);
+  free(s);
+  lval_free(val);
+
+  const char *exprs[] = {
+    "(- (+ 9223372036854775807 10) 20)",
+    "(+ 100000000000000000000 -99999999999999999999)",
+    "(- -9223372036854775808 1 -1)",
+  };
+  int64_t ints[] = { 9223372036854775797LL, 1, INT64_MIN };
+  TEST_ASSERT_EQUAL(sizeof(exprs) / sizeof(*exprs), sizeof(ints) / sizeof(*ints));
+  for (long i = 0; i < sizeof(exprs) / sizeof(*exprs); i++) {
+    val = lval_eval(env, read_string(exprs[i]));
+    TEST_ASSERT_EQUAL(LVAL_INT, val->type);
+    TEST_ASSERT_TRUE(LVAL_INT_VALUE(val) == ints[i]);
+    lval_free(val);
+  }
+
+  val = lval_eval(env, read_string("(list (> 100000000000000000000 99999999999999999999) "
+                                   "(= (* 4294967296 4294967296) 18446744073709551616) "
+                                   "(equal 18446744073709551616 18446744073709551616) "
+                                   "(< 1.5 18446744073709551616))"));
+  for (long i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL(LVAL_SYM, lval_lst_nth(val, i)->type);
+  }
+  lval_free(val);
+
+  val = lval_eval(env, read_string("(/ 18446744073709551616 4)"));
+  TEST_ASSERT_EQUAL(LVAL_NUM, val->type);
+  TEST_ASSERT_EQUAL_FLOAT(4611686018427387904.0, LVAL_NUM_VALUE(val));
+  lval_free(val);
+  val = lval_eval(env, read_string("(/ 18446744073709551616 0)"));
+  TEST_ASSERT_EQUAL(LVAL_ERR, val->type);
+  lval_free(val);
+  lenv_free(env);
+}
+
+void
+test_larray_builtins ()
+{
+  lenv *env = test_env();
+  lenv_register_builtin(env, "*", builtin_mul, 0);
+  lenv_register_builtin(env, "min", builtin_min, 0);
+  lenv_register_builtin(env, "max", builtin_max, 0);
+  lenv_register_builtin(env, "dot", builtin_dot, 0);
+  lenv_register_builtin(env, "apply", builtin_apply, 0);
+  lenv_register_builtin(env, "f64-array", builtin_f64_array, 0);
+  lval_free(lval_eval(env, read_string("(def v (f64-array 1 2.5 -3 4))")));
+
+  const char *exprs[] = { "(+ v)", "(* v)", "(min v)", "(max v)", "(dot v v)", "(apply + (list 1 2.5 -3 4))" };
+  double nums[] = { 4.5, -30, -3, 4, 32.25, 4.5 };
+  TEST_ASSERT_EQUAL(sizeof(exprs) / sizeof(*exprs), sizeof(nums) / sizeof(*nums));
+  for (long i = 0; i < sizeof(exprs) / sizeof(*exprs); i++) {
+    lval *val = lval_eval(env, read_string(exprs[i]));
+    TEST_ASSERT_EQUAL(LVAL_NUM, val->type);
+    TEST_ASSERT_EQUAL_FLOAT(nums[i], LVAL_NUM_VALUE(val));
+    lval_free(val);
+  }
+
+  // Lists keep exact integers, and the smallest keeps its type.
+  lval *val = lval_eval(env, read_string("(list (apply + {1 2 3}) (min 3 1.5 2) (max 1 9223372036854775808))"));
+  TEST_ASSERT_EQUAL(6, LVAL_INT_VALUE(lval_lst_nth(val, 0)));
+  TEST_ASSERT_EQUAL(LVAL_NUM, lval_lst_nth(val, 1)->type);
+  TEST_ASSERT_EQUAL(LVAL_BIG, lval_lst_nth(val, 2)->type);
+  lval_free(val);
+
+  const char *errors[] = { "(+ v 1)", "(min (f64-array))", "(dot v (f64-array 1))", "(f64-array 1 {})", "(apply + 1)" };
+  for (long i = 0; i < sizeof(errors) / sizeof(*errors); i++) {
+    val = lval_eval(env, read_string(errors[i]));
+    TEST_ASSERT_EQUAL(LVAL_ERR, val->type);
+    lval_free(val);
+  }
+  lenv_free(env);
+}
+
+void
+test_larray_typed ()
+{
+  lenv *env = test_env();
+  lenv_register_builtins(env);
+  lval_free(lval_eval(env, read_string("(def b (u8-array 1 2 255 4))")));
+  lval_free(lval_eval(env, read_string("(def i (i64-array 9223372036854775807 2 -3))")));
+
+  const char *exprs[] = {
+    "(array-ref b 2)", "(array-length i)", "(array-ref (array-slice b 1 3) 1)",
+    "(+ b)", "(* b)", "(min i)", "(max b)",
+    "(array-ref (array-map (lambda {x} {- 255 x}) b) 0)",
+    "(array-reduce (lambda {a x} {+ a x}) 0 b)",
+  };
+  int64_t ints[] = { 255, 3, 255, 262, 2040, -3, 255, 254, 262 };
+  TEST_ASSERT_EQUAL(sizeof(exprs) / sizeof(*exprs), sizeof(ints) / sizeof(*ints));
+  for (long k = 0; k < sizeof(exprs) / sizeof(*exprs); k++) {
+    lval *val = lval_eval(env, read_string(exprs[k]));
+    TEST_ASSERT_EQUAL(LVAL_INT, val->type);
+    TEST_ASSERT_TRUE(LVAL_INT_VALUE(val) == ints[k]);
+    lval_free(val);
+  }
+
+  // Integer arrays sum exactly, past 64 bits as bignums.
+  lval *val = lval_eval(env, read_string("(+ i)"));
+  TEST_ASSERT_EQUAL(LVAL_INT, val->type);
+  TEST_ASSERT_TRUE(LVAL_INT_VALUE(val) == 9223372036854775806LL);
+  lval_free(val);
+  val = lval_eval(env, read_string("(* i)"));
+  TEST_ASSERT_EQUAL(LVAL_BIG, val->type);
+  lval_free(val);
+
+  const char *errors[] = {
+    "(u8-array 256)", "(u8-array -1)", "(i64-array 1.5)", "(array-ref b 4)", "(array-slice b 3 2)",
+    "(array-map (lambda {x} {+ x 1}) b)", "(dot b b)", "(read-array \"i32\" \"x\")",
+  };
+  for (long k = 0; k < sizeof(errors) / sizeof(*errors); k++) {
+    val = lval_eval(env, read_string(errors[k]));
+    TEST_ASSERT_EQUAL(LVAL_ERR, val->type);
+    lval_free(val);
+  }
+
+  FILE *file = fopen("/tmp/test-lval.bin", "wb");
+  int64_t data[] = { 5, -6, 7 };
+  fwrite(data, sizeof(int64_t), 3, file);
+  fclose(file);
+  val = lval_eval(env, read_string("(list (read-array \"i64\" \"/tmp/test-lval.bin\") "
+                                   "(read-array \"u8\" \"/tmp/test-lval.bin\") "
+                                   "(read-array \"f64\" \"/tmp/test-lval.bin\"))"));
+  larray *a = lval_lst_nth(val, 0)->value;
+  TEST_ASSERT_EQUAL(LARRAY_I64, a->kind);
+  TEST_ASSERT_EQUAL(3, a->length);
+  TEST_ASSERT_TRUE(LARRAY_I64(a)[1] == -6);
+  TEST_ASSERT_EQUAL(24, ((larray*)lval_lst_nth(val, 1)->value)->length);
+  TEST_ASSERT_EQUAL(3, ((larray*)lval_lst_nth(val, 2)->value)->length);
+  lval_free(val);
+
+  file = fopen("/tmp/test-lval.bin", "ab");
+  fputc(0, file);
+  fclose(file);
+  val = lval_eval(env, read_string("(read-array \"i64\" \"/tmp/test-lval.bin\")"));
+  TEST_ASSERT_EQUAL(LVAL_ERR, val->type);
+  lval_free(val);
+  remove("/tmp/test-lval.bin");
+  lenv_free(env);
+}
+
+void
+test_lvector ()
+{
+  lgc_collect();
+  lenv *env = test_env();
+  lenv_register_builtins(env);
+  lval_free(lval_eval(env, read_string("(def v (vector 1 \"s\" {2}))")));
+  for (long i = 0; i < 1000; i++) {
+    lval_free(lval_eval(env, read_string("(push! v (len v))")));
+  }
+
+  const char *exprs[] = {
+    "(len v)", "(nth v 999)", "(nth (set-nth! v 0 7) 0)", "(len (slice v 2 10))",
+    "(nth (slice v 2 10) 1)", "(nth {4 5 6} 2)", "(len {4 5})", "(len (vector))",
+  };
+  int64_t ints[] = { 1003, 999, 7, 8, 3, 6, 2, 0 };
+  TEST_ASSERT_EQUAL(sizeof(exprs) / sizeof(*exprs), sizeof(ints) / sizeof(*ints));
+  for (long k = 0; k < sizeof(exprs) / sizeof(*exprs); k++) {
+    lval *val = lval_eval(env, read_string(exprs[k]));
+    TEST_ASSERT_EQUAL(LVAL_INT, val->type);
+    TEST_ASSERT_TRUE(LVAL_INT_VALUE(val) == ints[k]);
+    lval_free(val);
+  }
+
+  // Copies share the vector, and see it change.
+  lval_free(lval_eval(env, read_string("(def w v)")));
+  lval_free(lval_eval(env, read_string("(set-nth! w 1 \"t\")")));
+  lval *val = lval_eval(env, read_string("(list (nth v 1) (equal v w) (equal v (slice v 0 1003)))"));
+  TEST_ASSERT_EQUAL_STRING("t", lval_lst_nth(val, 0)->value);
+  TEST_ASSERT_FALSE(LVAL_IS_NIL(lval_lst_nth(val, 1)));
+  TEST_ASSERT_TRUE(LVAL_IS_NIL(lval_lst_nth(val, 2)));
+  lval_free(val);
+
+  const char *errors[] = {
+    "(nth v 1003)", "(nth v -1)", "(nth v 1.0)", "(set-nth! {1} 0 1)", "(push! {} 1)",
+    "(slice v 2 1)", "(slice v 0 1004)", "(len 1)",
+  };
+  for (long k = 0; k < sizeof(errors) / sizeof(*errors); k++) {
+    val = lval_eval(env, read_string(errors[k]));
+    TEST_ASSERT_EQUAL(LVAL_ERR, val->type);
+    lval_free(val);
+  }
+
+  // A vector holding itself is freed by the collector.
+  lval_free(lval_eval(env, read_string("(push! v v)")));
+  lenv_free(env);
+  TEST_ASSERT_TRUE(lgc_collect() > 0);
+  TEST_ASSERT_NULL(lvector_all);
+}
+
+void
+test_limage ()
+{
+  lgc_collect();
+  lenv *env = test_env();
+  lval_free(lval_eval(env, read_string("(def adder (lambda {x} {lambda {y} {+ x y}}))")));
+  lval_free(lval_eval(env, read_string("(def add2 (adder 2))")));
+  lval_free(lval_eval(env, read_string("(def data {1 \"s\" sym {} -18446744073709551616})")));
+  lenv_register_builtin(env, "f64-array", builtin_f64_array, 0);
+  lenv_register_builtin(env, "u8-array", builtin_u8_array, 0);
+  lval_free(lval_eval(env, read_string("(def arr (f64-array 0.5 2))")));
+  lval_free(lval_eval(env, read_string("(def bytes (u8-array 7 255))")));
+  lenv_register_builtin(env, "vector", builtin_vector, 0);
+  lenv_register_builtin(env, "push!", builtin_push, 0);
+  lval_free(lval_eval(env, read_string("(def vec (vector 1 2))")));
+  lval_free(lval_eval(env, read_string("(push! vec vec)")));
+  lval *val = limage_save(env, "/tmp/test-lval.img");
+  TEST_ASSERT_EQUAL(LVAL_LST, lval_type(val));
+  lval_free(val);
+  lenv_free(env);
+  lgc_collect();
+
+  env = limage_load("/tmp/test-lval.img");
+  TEST_ASSERT_NOT_NULL(env);
+  val = lval_eval(env, read_string("(add2 40)"));
+  TEST_ASSERT_EQUAL(42, LVAL_INT_VALUE(val));
+  lval_free(val);
+
+  val = lval_eval(env, read_string("data"));
+  TEST_ASSERT_TRUE(lval_is_quoted(val));
+  TEST_ASSERT_EQUAL(5, lval_lst_length(val));
+  TEST_ASSERT_EQUAL_STRING("s", lval_lst_nth(val, 1)->value);
+  TEST_ASSERT_EQUAL_PTR(string_intern("sym"), lval_lst_nth(val, 2)->value);
+  char *s = lbig_string(lval_lst_nth(val, 4)->value);
+  TEST_ASSERT_EQUAL_STRING("-18446744073709551616", s);
+  free(s);
+  lval_free(val);
+
+  val = lval_eval(env, read_string("arr"));
+  TEST_ASSERT_EQUAL(LVAL_ARR, val->type);
+  TEST_ASSERT_EQUAL(2, ((larray*)val->value)->length);
+  TEST_ASSERT_EQUAL_FLOAT(2, LARRAY_F64((larray*)val->value)[1]);
+  lval_free(val);
+  val = lval_eval(env, read_string("bytes"));
+  TEST_ASSERT_EQUAL(LARRAY_U8, ((larray*)val->value)->kind);
+  TEST_ASSERT_EQUAL(255, LARRAY_U8((larray*)val->value)[1]);
+  lval_free(val);
+  val = lval_eval(env, read_string("vec"));
+  tlist *members = ((lvector*)val->value)->members;
+  TEST_ASSERT_EQUAL(3, list_length(members));
+  TEST_ASSERT_EQUAL(2, LVAL_INT_VALUE((lval*)list_nth(members, 1)));
+  TEST_ASSERT_EQUAL_PTR(val->value, ((lval*)list_nth(members, 2))->value);
+  lval_free(val);
+
+  // Functions share the environment they were defined in.
+  lfun *f = lenv_get_key(env, string_intern("adder"))->value;
+  TEST_ASSERT_EQUAL_PTR(env, f->env);
+  TEST_ASSERT_NOT_NULL(f->code);
+  lenv_free(env);
+  TEST_ASSERT_TRUE(lgc_collect() > 0);
+  TEST_ASSERT_NULL(lenv_all);
+  TEST_ASSERT_NULL(lvector_all);
+
+  TEST_ASSERT_NULL(limage_load("/tmp/test-lval.c.missing"));
+  remove("/tmp/test-lval.img");
+}
+
+void
+test_lfasl ()
+{
+  FILE *file = fopen("/tmp/test-lval.lisp", "w");
+  fputs("{1 \"two\" three (4)}", file);
+  fclose(file);
+  remove("/tmp/test-lval.fasl");
+
+  // Without a fasl the source is read and the fasl written.
+  lval *arg = read_string("{\"/tmp/test-lval.fasl\" \"/tmp/test-lval.lisp\"}");
+  lval *val = builtin_load_fasl(NULL, arg);
+  TEST_ASSERT_EQUAL(4, lval_lst_length(val));
+  lval_free(val);
+
+  val = lfasl_load("/tmp/test-lval.fasl", "/tmp/test-lval.lisp");
+  TEST_ASSERT_NOT_NULL(val);
+  TEST_ASSERT_TRUE(lval_is_quoted(val));
+  TEST_ASSERT_EQUAL(1, LVAL_INT_VALUE(lval_lst_nth(val, 0)));
+  TEST_ASSERT_EQUAL_STRING("two", lval_lst_nth(val, 1)->value);
+  TEST_ASSERT_EQUAL_PTR(string_intern("three"), lval_lst_nth(val, 2)->value);
+  TEST_ASSERT_FALSE(lval_is_quoted(lval_lst_nth(val, 3)));
+  lval_free(val);
+
+  // A changed source makes the fasl out of date.
+  file = fopen("/tmp/test-lval.lisp", "w");
+  fputs("{1 2}", file);
+  fclose(file);
+  TEST_ASSERT_NULL(lfasl_load("/tmp/test-lval.fasl", "/tmp/test-lval.lisp"));
+  val = builtin_load_fasl(NULL, arg);
+  TEST_ASSERT_EQUAL(2, lval_lst_length(val));
+  lval_free(val);
+
+  // So does one rewritten at once with contents of the same size.
+  file = fopen("/tmp/test-lval.lisp", "w");
+  fputs("{3 4}", file);
+  fclose(file);
+  val = builtin_load_fasl(NULL, arg);
+  TEST_ASSERT_EQUAL(3, LVAL_INT_VALUE(lval_lst_nth(val, 0)));
+  lval_free(val);
+  lval_free(arg);
+
+  lenv *env = test_env();
+  val = lval_eval(env, read_string("(lambda {x} {x})"));
+  lval *err = lfasl_save("/tmp/test-lval.fasl", val, NULL);
+  TEST_ASSERT_EQUAL(LVAL_ERR, lval_type(err));
+  lval_free(err);
+  lval_free(val);
+  lenv_free(env);
+
+  remove("/tmp/test-lval.lisp");
+  remove("/tmp/test-lval.fasl");
+}
+
 int
 main()
 {
     UNITY_BEGIN();
     RUN_TEST(test_lenv_put);
     RUN_TEST(test_lenv_get);
+    RUN_TEST(test_lenv_get_many);
     RUN_TEST(test_lenv_get_err);
     RUN_TEST(test_lval_sym_leak);
+    RUN_TEST(test_lval_sym_interned);
     RUN_TEST(test_lval_num_leak);
+    RUN_TEST(test_lval_num_copy);
+    RUN_TEST(test_lval_unshare);
+    RUN_TEST(test_lval_lst_shared);
     RUN_TEST(test_lval_eval_sym);
     RUN_TEST(test_lval_eval_lst);
     RUN_TEST(test_lval_eval_lst_error);
     RUN_TEST(test_builtin_identity);
+    RUN_TEST(test_lval_eval_tail_call);
+    RUN_TEST(test_lcode_compile);
+    RUN_TEST(test_lcode_closure);
+    RUN_TEST(test_lfun_shared_env);
+    RUN_TEST(test_lgc_collect);
+    RUN_TEST(test_lnum_arith);
+    RUN_TEST(test_lbig_promote);
+    RUN_TEST(test_larray_builtins);
+    RUN_TEST(test_larray_typed);
+    RUN_TEST(test_lvector);
+    RUN_TEST(test_limage);
+    RUN_TEST(test_lfasl);
     return UNITY_END();
 }
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <string.h>
 extern char *strdup (const char *s);
 
@@ -92,6 +93,35 @@ test_string_trim ()
   free(s);
 }
 
+void
+test_string_intern ()
+{
+  char *s = strdup("symbol");
+  const char *a = string_intern("symbol");
+  const char *b = string_intern(s);
+  TEST_ASSERT_EQUAL_PTR(a, b);
+  TEST_ASSERT_NOT_EQUAL(a, string_intern("other"));
+
+  char name[16];
+  for (long i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "name%ld", i);
+    string_intern(name);
+  }
+  TEST_ASSERT_EQUAL_PTR(a, string_intern("symbol"));
+
+  // Only the given bytes count, prefixes are different strings.
+  TEST_ASSERT_EQUAL_PTR(a, string_intern_n("symbol)", 6));
+  TEST_ASSERT_NOT_EQUAL(a, string_intern_n("symbol", 3));
+  TEST_ASSERT_EQUAL_STRING("sym", string_intern_n("symbol", 3));
+
+  // Looking up a string does not intern it.
+  TEST_ASSERT_EQUAL_PTR(a, string_interned("symbol"));
+  TEST_ASSERT_NULL(string_interned("never interned"));
+  TEST_ASSERT_NULL(string_interned("never interned"));
+
+  free(s);
+}
+
 void
 test_list_append ()
 {
@@ -145,6 +175,90 @@ test_list_take ()
   list_free(lst);
 }
 
+void
+test_list_set ()
+{
+  tlist *lst = list();
+  char  *one = strdup("one");
+  char  *two = strdup("two");
+
+  list_append(lst, one);
+  TEST_ASSERT_EQUAL_STRING(one, list_set(lst, 0, two));
+  TEST_ASSERT_EQUAL_STRING(two, list_nth(lst, 0));
+  TEST_ASSERT_NULL(list_set(lst, 1, one));
+  TEST_ASSERT_EQUAL(1, list_length(lst));
+
+  free(one);
+  free(two);
+  list_free(lst);
+}
+
+void
+test_list_capacity ()
+{
+  tlist *lst = list_sized(2);
+  char  *one = strdup("one");
+
+  for (long i = 0; i < 1000; i++) {
+    list_append(lst, one);
+  }
+  TEST_ASSERT_EQUAL(1000, list_length(lst));
+  TEST_ASSERT_TRUE(lst->capacity >= 1000);
+
+  for (long i = 0; i < 990; i++) {
+    list_take(lst, 0);
+  }
+  TEST_ASSERT_EQUAL(10, list_length(lst));
+  TEST_ASSERT_TRUE(lst->capacity <= 40);
+  TEST_ASSERT_EQUAL_STRING(one, list_nth(lst, 9));
+
+  free(one);
+  list_free(lst);
+}
+
+void
+test_mem_alloc ()
+{
+  char *a = mem_alloc(20);
+  char *b = mem_alloc(20);
+  TEST_ASSERT_TRUE(a != b);
+  mem_free(a, 20);
+  char *c = mem_alloc(32);
+#ifndef MEM_MALLOC
+  TEST_ASSERT_EQUAL_PTR(a, c);
+#endif
+  a = c;
+
+  c = mem_realloc(b, 20, 30);
+#ifndef MEM_MALLOC
+  TEST_ASSERT_EQUAL_PTR(b, c);
+#endif
+  c = mem_realloc(c, 30, 4000);
+  memset(c, 1, 4000);
+  mem_free(c, 4000);
+  mem_free(a, 32);
+
+  char *s = mem_strdup("string");
+  TEST_ASSERT_EQUAL_STRING("string", s);
+  mem_strfree(s);
+}
+
+void
+test_pool_alloc ()
+{
+  static mem_pool pool = MEM_POOL(24);
+  void *a = pool_alloc(&pool);
+  void *b = pool_alloc(&pool);
+  TEST_ASSERT_TRUE(a != b);
+  pool_free(&pool, a);
+  void *c = pool_alloc(&pool);
+#ifndef MEM_MALLOC
+  TEST_ASSERT_EQUAL_PTR(a, c);
+#endif
+  pool_free(&pool, b);
+  pool_free(&pool, c);
+}
+
 int
 main()
 {
@@ -155,8 +269,13 @@ main()
     RUN_TEST(test_string_ltrim);
     RUN_TEST(test_string_rtrim);
     RUN_TEST(test_string_trim);
+    RUN_TEST(test_string_intern);
     RUN_TEST(test_list_append);
     RUN_TEST(test_list_insert);
     RUN_TEST(test_list_take);
+    RUN_TEST(test_list_set);
+    RUN_TEST(test_list_capacity);
+    RUN_TEST(test_mem_alloc);
+    RUN_TEST(test_pool_alloc);
     return UNITY_END();
 }